@@ -6,7 +6,13 @@
 #include <getopt.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/ioctl.h>
 #include <string.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/rtc.h>
 
 
 /* V1.0
@@ -114,12 +120,23 @@
  * August 1996 Tom Dyas (tdyas@eden.rutgers.edu)
  *       Converted to be compatible with the SPARC /dev/rtc driver.
  *
+ * V1.5
+ *       Uses the generic Linux RTC interface (RTC_RD_TIME, RTC_SET_TIME) of
+ *       linux/rtc.h, which is what the LPC3250 RTC driver provides.
+ *       Added -d: keep the system clock synchronized to the RTC. See
+ *       rtc_daemon() below.
+ *       The drift correction of -a is no longer one fixed factor in
+ *       /etc/adjtime, it is estimated from a history of measurements in
+ *       /etc/adjtime.log. See the drift log below. -l prints the history,
+ *       -t checks the estimate on a scratch log.
+ *
  */
 
-#define VERSION "1.4"
+#define VERSION "1.5"
 
 /* Here the information for time adjustments is kept. */
 #define ADJPATH "/etc/adjtime"
+#define DRIFTPATH "/etc/adjtime.log"
 
 
 /* used for debugging the code. */
@@ -130,6 +147,9 @@ int readit = 0;
 int adjustit = 0;
 int writeit = 0;
 int setit = 0;
+int daemonit = 0;
+int listit = 0;
+int checkit = 0;
 int universal = 0;
 int debug = 0;
 
@@ -137,11 +157,14 @@ volatile void
 usage ()
 {
   fprintf (stderr, 
-    "clock [-u] -r|w|s|a|v\n"
+    "clock [-u] -r|w|s|a|d|l|t|v\n"
     "  r: read and print CMOS clock\n"
     "  w: write CMOS clock from system time\n"
     "  s: set system time from CMOS clock\n"
     "  a: get system time and adjust CMOS clock\n"
+    "  d: keep the system time synchronized to the CMOS clock, runs until killed\n"
+    "  l: print the drift history of " DRIFTPATH " and the current estimate\n"
+    "  t: check the drift estimate on a scratch log and exit\n"
     "  u: CMOS clock is in universal time\n"
     "  v: print version (" VERSION ") and exit\n"
   );
@@ -161,20 +184,727 @@ rtc_init ()
     }
 }
 
+/*
+ * Reads the RTC into tm.
+ */
+void
+rtc_read_tm (struct tm *tm)
+{
+  struct rtc_time rtc_tm;
+
+  if (ioctl (rtc_fd, RTC_RD_TIME, &rtc_tm) < 0)
+    {
+      perror ("ioctl(RTC_RD_TIME)");
+      exit (2);
+    }
+
+  memset (tm, 0, sizeof (*tm));
+  tm->tm_sec = rtc_tm.tm_sec;
+  tm->tm_min = rtc_tm.tm_min;
+  tm->tm_hour = rtc_tm.tm_hour;
+  tm->tm_wday = rtc_tm.tm_wday;
+  tm->tm_mday = rtc_tm.tm_mday;
+  tm->tm_mon = rtc_tm.tm_mon;
+  tm->tm_year = rtc_tm.tm_year;
+  tm->tm_isdst = -1;		/* don't know whether it's daylight */
+}
+
+/*
+ * mktime() assumes we're giving it local time.  If the CMOS clock
+ * is in GMT, we have to set up TZ so mktime knows it.  tzset() gets
+ * called implicitly by the time code, but only the first time.  When
+ * changing the environment variable, better call tzset() explicitly.
+ */
+time_t
+rtc_mktime (struct tm *tm)
+{
+  time_t systime;
+
+  if (universal)
+    {
+      char *zone;
+      zone = (char *) getenv ("TZ");	/* save original time zone */
+      (void) putenv ("TZ=");
+      tzset ();
+      systime = mktime (tm);
+      /* now put back the original zone */
+      if (zone)
+	{
+
+         char *zonebuf;
+         zonebuf = malloc (strlen (zone) + 4);
+         strcpy (zonebuf, "TZ=");
+         strcpy (zonebuf+3, zone);
+         putenv (zonebuf);
+         free (zonebuf);
+	}
+      else
+	{			/* wasn't one, so clear it */
+	  putenv ("TZ");
+	}
+      tzset ();
+    }
+  else
+    {
+      systime = mktime (tm);
+    }
+  return systime;
+}
+
+/*
+ * Daemon mode (-d).
+ *
+ * -s sets the system time from a single RTC read and drops the fraction of
+ * the second, so the system clock can be up to a second off.  The RTC only
+ * counts whole seconds, but it does tell exactly when a new second starts:
+ * with update interrupts enabled (RTC_UIE_ON) a read() of /dev/rtc blocks
+ * until the seconds register changes.  The system time taken right after
+ * that read is compared to the new RTC second, which gives the offset with
+ * the accuracy of the wakeup latency (tens of microseconds), instead of a
+ * second.
+ *
+ * The RTC is read with RTC_RD_TIME only at the first edge and then every
+ * DAEMON_VERIFY seconds, in between every update interrupt simply adds a
+ * second (read() also returns how many interrupts happened since the last
+ * read, so a missed one isn't lost).
+ *
+ * The wakeup latency only ever makes the system time look late, so the
+ * smallest offset of DAEMON_WINDOW edges is the best estimate.  That offset
+ * is removed with adjtime(), which slews the clock (at most 0.5 ms per
+ * second on Linux) so time never jumps or runs backwards.  Only offsets
+ * larger than DAEMON_STEP_LIMIT, like at boot, are stepped with
+ * settimeofday(), keeping the microseconds this time.
+ */
+#define DAEMON_WINDOW 8		/* edges per correction */
+#define DAEMON_STEP_LIMIT 0.5	/* seconds */
+#define DAEMON_VERIFY 600	/* edges between two RTC_RD_TIME reads */
+#define DAEMON_REPORT 60	/* edges between two offset reports */
+
+volatile sig_atomic_t daemon_stop = 0;
+
+void
+daemon_signal (int sig)
+{
+  daemon_stop = 1;
+}
+
+double
+timeval_seconds (const struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+struct timeval
+seconds_timeval (double seconds)
+{
+  struct timeval tv;
+
+  tv.tv_sec = (time_t) seconds;
+  tv.tv_usec = (long) ((seconds - tv.tv_sec) * 1e6);
+  if (tv.tv_usec < 0)
+    {
+      tv.tv_sec--;
+      tv.tv_usec += 1000000;
+    }
+  return tv;
+}
+
+/*
+ * Steps the system time to rtc_second plus the time passed since the edge
+ * at which the RTC changed to rtc_second.
+ */
+void
+daemon_step (time_t rtc_second, const struct timeval *edge)
+{
+  struct timeval now, tv;
+  struct timeval zero = { 0, 0 };
+
+  gettimeofday (&now, NULL);
+  tv = seconds_timeval (rtc_second + timeval_seconds (&now) - timeval_seconds (edge));
+  adjtime (&zero, NULL);	/* cancel a slew that is still going on */
+  if (settimeofday (&tv, NULL) != 0)
+    {
+      perror ("settimeofday");
+      exit (1);
+    }
+}
+
+void
+rtc_daemon ()
+{
+  struct tm tm;
+  struct timeval edge, slew;
+  unsigned long data;
+  unsigned long edges = 0;
+  unsigned long next_verify = 0;
+  unsigned long next_report = DAEMON_REPORT;
+  int window_size = 0;
+  double offset, window_offset = 0;
+  time_t rtc_second = 0;
+
+  if (getuid () != 0)
+    {
+      fprintf (stderr, "Sorry, must be root to set or adjust time\n");
+      exit (2);
+    }
+
+  signal (SIGINT, daemon_signal);
+  signal (SIGTERM, daemon_signal);
+
+  if (ioctl (rtc_fd, RTC_UIE_ON, 0) < 0)
+    {
+      perror ("ioctl(RTC_UIE_ON)");
+      exit (2);
+    }
+
+  while (!daemon_stop)
+    {
+      /* blocks until the RTC starts a new second */
+      if (read (rtc_fd, &data, sizeof (data)) != sizeof (data))
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror ("read /dev/rtc");
+	  break;
+	}
+      gettimeofday (&edge, NULL);
+
+      if (edges >= next_verify)
+	{
+	  rtc_read_tm (&tm);
+	  rtc_second = rtc_mktime (&tm);
+	  next_verify = edges + DAEMON_VERIFY;
+	}
+      else
+	{
+	  rtc_second += data >> 8;	/* the number of interrupts since the last read */
+	}
+      edges += data >> 8;
+
+      offset = timeval_seconds (&edge) - rtc_second;
+      if (offset > DAEMON_STEP_LIMIT || offset < -DAEMON_STEP_LIMIT)
+	{
+	  daemon_step (rtc_second, &edge);
+	  printf ("stepped the system time by %+.6f s\n", -offset);
+	  fflush (stdout);
+	  window_size = 0;
+	  continue;
+	}
+
+      if (window_size == 0 || offset < window_offset)
+	window_offset = offset;
+      window_size++;
+      if (window_size < DAEMON_WINDOW)
+	continue;
+
+      /* adjtime replaces a slew that is still going on, so it never accumulates */
+      slew = seconds_timeval (-window_offset);
+      if (adjtime (&slew, NULL) != 0)
+	{
+	  perror ("adjtime");
+	  break;
+	}
+      window_size = 0;
+
+      if (debug || edges >= next_report)
+	{
+	  printf ("offset %+.6f s, slewing %+.6f s\n", window_offset, -window_offset);
+	  fflush (stdout);
+	  next_report = edges + DAEMON_REPORT;
+	}
+    }
+
+  ioctl (rtc_fd, RTC_UIE_OFF, 0);
+}
+
+/*
+ * The drift log.
+ *
+ * /etc/adjtime only holds one correction factor, which the user has to
+ * measure and type in, and which doesn't follow drift that changes with
+ * the temperature or the age of the crystal.  /etc/adjtime.log keeps a
+ * history instead, and the factor is estimated from the most recent
+ * DRIFT_WINDOW measurements.
+ *
+ * A measurement is made every time the CMOS clock is written from a
+ * (trusted) system time with -w: right before writing, the CMOS error is
+ * read, minus the corrections -a already wrote into the CMOS since the last
+ * -w.  Divided by the time since the last -w, that is the drift rate.
+ *
+ * The file is a drift_header followed by fixed size drift_records, and is
+ * only ever appended to, so a crash can at worst lose the last record.
+ * It is read through mmap, nothing is parsed.  Every record holds the
+ * running sums of all measured errors and intervals, and the index of the
+ * first record of its window, so the estimate is
+ *   (cum_error[last] - cum_error[window_start - 1]) /
+ *   (cum_interval[last] - cum_interval[window_start - 1])
+ * which costs the same for 10 or 10000 records, and so does appending a
+ * record: the window start only moves forward.  Longer intervals weigh
+ * more, as they should: their error is measured more precisely.
+ */
+#define DRIFT_MAGIC "CLKDRIFT"
+#define DRIFT_VERSION 1
+#define DRIFT_WINDOW 16
+
+#define DRIFT_SET 1		/* CMOS written from the system time (-w) */
+#define DRIFT_MEASURE 2		/* CMOS error measured right before a -w */
+#define DRIFT_ADJUST 3		/* system time set and adjusted from CMOS (-a) */
+
+struct drift_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t window;		/* measurements in the sliding window */
+  uint32_t reserved;
+  double prior_rate;		/* drift rate used before there are measurements */
+};
+
+struct drift_record
+{
+  int64_t time;			/* when this happened, seconds since 1970 */
+  int64_t last_set;		/* time of the last DRIFT_SET */
+  int64_t last_adjust;		/* time the next -a has to correct from */
+  double error;			/* MEASURE: CMOS error (s), ADJUST: adjustment (s) */
+  double not_adjusted;		/* part of a second left after the last adjustment */
+  double corrected;		/* adjustments written into the CMOS since last_set */
+  double cum_interval;		/* sum of all measured intervals up to here */
+  double cum_error;		/* sum of all measured errors up to here */
+  uint32_t measurements;	/* number of measurements up to here */
+  uint32_t window_start;	/* first record of the sliding window */
+  uint32_t kind;
+  uint32_t reserved;
+};
+
+/* the log and the file it replaces, only the check of -t uses others */
+const char *drift_path = DRIFTPATH;
+const char *adjtime_path = ADJPATH;
+
+struct drift_log
+{
+  int fd;
+  struct drift_header *header;
+  struct drift_record *records;
+  uint32_t count;
+  size_t map_size;
+};
+
+/*
+ * Maps the first size bytes of the log, the header and every whole record
+ * in them.
+ */
+void
+drift_map (struct drift_log *log, size_t size)
+{
+  log->map_size = size;
+  log->header = mmap (NULL, log->map_size, PROT_READ, MAP_SHARED, log->fd, 0);
+  if (log->header == MAP_FAILED)
+    {
+      perror (drift_path);
+      exit (2);
+    }
+  log->records = (struct drift_record *) (log->header + 1);
+  log->count = (log->map_size - sizeof (struct drift_header)) / sizeof (struct drift_record);
+}
+
+/*
+ * Opens and maps the drift log, creating it when it doesn't exist yet.  A
+ * new log takes over /etc/adjtime, if there is one: its factor becomes the
+ * prior rate, and an adjust record carries its last adjustment time and the
+ * fraction it had left, so the first -a corrects from there.
+ */
+void
+drift_open (struct drift_log *log)
+{
+  struct stat st;
+  size_t records_size;
+
+  log->fd = open (drift_path, O_RDWR | O_APPEND | O_CREAT, 0644);
+  if (log->fd < 0 || fstat (log->fd, &st) != 0)
+    {
+      perror (drift_path);
+      exit (2);
+    }
+
+  if (st.st_size == 0)
+    {
+      struct drift_header header;
+      FILE *adj;
+      double factor = 0, not_adjusted = 0;
+      long last_time = 0;
+      int migrated = 0;
+
+      memset (&header, 0, sizeof (header));
+      memcpy (header.magic, DRIFT_MAGIC, sizeof (header.magic));
+      header.version = DRIFT_VERSION;
+      header.record_size = sizeof (struct drift_record);
+      header.window = DRIFT_WINDOW;
+      if ((adj = fopen (adjtime_path, "r")) != NULL)
+	{
+	  migrated = fscanf (adj, "%lf %ld %lf", &factor, &last_time, &not_adjusted) == 3;
+	  if (migrated)
+	    header.prior_rate = -factor / (24 * 60 * 60);
+	  fclose (adj);
+	}
+      if (write (log->fd, &header, sizeof (header)) != sizeof (header))
+	{
+	  perror (drift_path);
+	  exit (2);
+	}
+      st.st_size = sizeof (header);
+
+      if (migrated && last_time != 0)
+	{
+	  struct drift_record record;
+
+	  memset (&record, 0, sizeof (record));
+	  record.kind = DRIFT_ADJUST;
+	  record.time = last_time;
+	  record.last_adjust = last_time;
+	  record.not_adjusted = not_adjusted;
+	  if (write (log->fd, &record, sizeof (record)) != sizeof (record))
+	    {
+	      perror (drift_path);
+	      exit (2);
+	    }
+	  st.st_size += sizeof (record);
+	}
+    }
+
+  if (st.st_size < sizeof (struct drift_header))
+    {
+      fprintf (stderr, "%s is damaged\n", drift_path);
+      exit (2);
+    }
+
+  /* drop a record that was only partly written */
+  records_size = st.st_size - sizeof (struct drift_header);
+  if (records_size % sizeof (struct drift_record) != 0)
+    {
+      st.st_size -= records_size % sizeof (struct drift_record);
+      if (ftruncate (log->fd, st.st_size) != 0)
+	{
+	  perror (drift_path);
+	  exit (2);
+	}
+    }
+
+  drift_map (log, st.st_size);
+  if (memcmp (log->header->magic, DRIFT_MAGIC, sizeof (log->header->magic)) != 0
+      || log->header->version != DRIFT_VERSION
+      || log->header->record_size != sizeof (struct drift_record))
+    {
+      fprintf (stderr, "%s is not a version %d drift log\n", drift_path, DRIFT_VERSION);
+      exit (2);
+    }
+}
+
+void
+drift_close (struct drift_log *log)
+{
+  munmap (log->header, log->map_size);
+  close (log->fd);
+}
+
+struct drift_record *
+drift_last (struct drift_log *log)
+{
+  return log->count > 0 ? &log->records[log->count - 1] : NULL;
+}
+
+/*
+ * The drift of the CMOS clock in seconds per second, positive when it runs
+ * fast.
+ */
+double
+drift_rate (struct drift_log *log)
+{
+  struct drift_record *last = drift_last (log);
+  struct drift_record *before;
+  double interval, error;
+
+  if (last == NULL || last->measurements == 0)
+    return log->header->prior_rate;
+
+  interval = last->cum_interval;
+  error = last->cum_error;
+  if (last->window_start > 0)
+    {
+      before = &log->records[last->window_start - 1];
+      interval -= before->cum_interval;
+      error -= before->cum_error;
+    }
+  if (interval <= 0)
+    return log->header->prior_rate;
+  return error / interval;
+}
+
+/*
+ * Appends a record.  The running sums and the window are carried over from
+ * the previous record, the caller fills in the rest of record.  The log is
+ * mapped again to include the new record, so the next append carries its
+ * sums over; pointers into the old mapping are no longer valid.
+ */
+void
+drift_append (struct drift_log *log, struct drift_record *record)
+{
+  struct drift_record *last = drift_last (log);
+  uint32_t window_start = last ? last->window_start : 0;
+  uint32_t before;
+
+  record->cum_interval = last ? last->cum_interval : 0;
+  record->cum_error = last ? last->cum_error : 0;
+  record->measurements = last ? last->measurements : 0;
+  if (record->kind == DRIFT_MEASURE)
+    {
+      record->cum_interval += record->time - record->last_set;
+      record->cum_error += record->error;
+      record->measurements++;
+    }
+
+  /* slide the window until it holds at most header->window measurements */
+  for (;;)
+    {
+      before = window_start > 0 ? log->records[window_start - 1].measurements : 0;
+      if (record->measurements - before <= log->header->window)
+	break;
+      window_start++;
+    }
+  record->window_start = window_start;
+  record->reserved = 0;
+
+  if (write (log->fd, record, sizeof (*record)) != sizeof (*record))
+    {
+      perror (drift_path);
+      exit (2);
+    }
+  munmap (log->header, log->map_size);
+  drift_map (log, log->map_size + sizeof (*record));
+}
+
+/*
+ * Logs how far the CMOS drifted since the last DRIFT_SET: rtc is what it
+ * reads now, corrections written into it by -a in the meantime don't count.
+ * The adjustment state is carried over, the record is the last one when -w
+ * fails to set the CMOS afterwards.
+ */
+void
+drift_measure (struct drift_log *log, time_t rtc, time_t now)
+{
+  struct drift_record *last = drift_last (log);
+  struct drift_record record;
+
+  memset (&record, 0, sizeof (record));
+  record.kind = DRIFT_MEASURE;
+  record.time = now;
+  record.last_set = last->last_set;
+  record.last_adjust = last->last_adjust;
+  record.not_adjusted = last->not_adjusted;
+  record.corrected = last->corrected;
+  record.error = (double) (rtc - now) - last->corrected;
+  drift_append (log, &record);
+  if (debug) printf ("CMOS drifted %+.0f seconds in %ld seconds\n",
+		     record.error, (long) (record.time - record.last_set));
+}
+
+void
+drift_set (struct drift_log *log, time_t now)
+{
+  struct drift_record record;
+
+  memset (&record, 0, sizeof (record));
+  record.kind = DRIFT_SET;
+  record.time = now;
+  record.last_set = now;
+  record.last_adjust = now;
+  drift_append (log, &record);
+}
+
+/*
+ * The whole number of seconds -a corrects the CMOS time systime by,
+ * not_adjusted receives the fraction that is left for the next time.  There
+ * is nothing to correct before there is an adjustment time to correct from.
+ */
+int
+drift_adjustment (struct drift_log *log, time_t systime, double *not_adjusted)
+{
+  struct drift_record *last = drift_last (log);
+  double exact_adjustment;
+  int adjustment;
+
+  if (last == NULL || last->last_adjust == 0)
+    {
+      *not_adjusted = 0;
+      return 0;
+    }
+
+  exact_adjustment = ((double) (systime - last->last_adjust))
+    * -drift_rate (log)
+    + last->not_adjusted;
+  if (exact_adjustment > 0)
+    adjustment = (int) (exact_adjustment + 0.5);
+  else
+    adjustment = (int) (exact_adjustment - 0.5);
+  *not_adjusted = exact_adjustment - (double) adjustment;
+  return adjustment;
+}
+
+void
+drift_list (struct drift_log *log)
+{
+  static const char *kinds[] = { "?", "set", "measure", "adjust" };
+  struct drift_record *record;
+  time_t t;
+  uint32_t i;
+
+  for (i = 0; i < log->count; i++)
+    {
+      record = &log->records[i];
+      t = record->time;
+      printf ("%-8s %.24s", kinds[record->kind <= DRIFT_ADJUST ? record->kind : 0], ctime (&t));
+      if (record->kind == DRIFT_MEASURE)
+	printf ("  error %+.1f s over %.2f days",
+		record->error, (record->time - record->last_set) / (24.0 * 60 * 60));
+      else if (record->kind == DRIFT_ADJUST)
+	printf ("  adjusted %+.0f s", record->error);
+      printf ("\n");
+    }
+  printf ("drift %+.3f seconds per day, from %u of %u measurements\n",
+	  drift_rate (log) * 24 * 60 * 60,
+	  drift_last (log) ? drift_last (log)->measurements
+	  - (drift_last (log)->window_start > 0
+	     ? log->records[drift_last (log)->window_start - 1].measurements : 0) : 0,
+	  drift_last (log) ? drift_last (log)->measurements : 0);
+}
+
+/*
+ * Creates an empty scratch file for the checks of -t, path is a mkstemp
+ * template.
+ */
+int
+drift_scratch (char *path)
+{
+  int fd = mkstemp (path);
+
+  if (fd < 0)
+    {
+      perror (path);
+      return -1;
+    }
+  close (fd);
+  return 0;
+}
+
+/*
+ * The first -a after /etc/adjtime was taken over corrects from the last
+ * adjustment time in it, one day at -10 seconds per day and 0.25 seconds
+ * left over, and not from 1970.  Without an adjustment time it corrects
+ * nothing.
+ */
+int
+drift_check_migration ()
+{
+  char path[] = "/tmp/clock.XXXXXX";
+  char adjtime[] = "/tmp/adjtime.XXXXXX";
+  struct drift_log log;
+  time_t then = 1000000000;
+  double not_adjusted;
+  int adjustment, ok;
+  FILE *adj;
+
+  if (drift_scratch (path) != 0 || drift_scratch (adjtime) != 0)
+    return 0;
+  adj = fopen (adjtime, "w");
+  fprintf (adj, "%.1f %ld %.2f\n", 10.0, (long) then, 0.25);
+  fclose (adj);
+
+  drift_path = path;
+  adjtime_path = adjtime;
+  drift_open (&log);
+  adjustment = drift_adjustment (&log, then + 24 * 60 * 60, &not_adjusted);
+  ok = log.count == 1 && adjustment == 10
+    && not_adjusted > 0.249 && not_adjusted < 0.251;
+  drift_close (&log);
+  unlink (path);
+  unlink (adjtime);
+
+  /* an empty /etc/adjtime, the log has no adjustment time */
+  strcpy (path, "/tmp/clock.XXXXXX");
+  strcpy (adjtime, "/tmp/adjtime.XXXXXX");
+  if (drift_scratch (path) != 0 || drift_scratch (adjtime) != 0)
+    return 0;
+  drift_open (&log);
+  ok = ok && log.count == 0 && drift_adjustment (&log, then, &not_adjusted) == 0;
+  drift_close (&log);
+  unlink (path);
+  unlink (adjtime);
+
+  printf ("migration check %s\n", ok ? "passed" : "FAILED");
+  return ok;
+}
+
+/*
+ * Three -w runs a day apart, with a CMOS clock that gains 10 seconds a day,
+ * on a scratch log instead of DRIFTPATH.  Both measurements have to end up
+ * in the estimate.
+ */
+int
+drift_check ()
+{
+  char path[] = "/tmp/clock.XXXXXX";
+  char adjtime[] = "/tmp/adjtime.XXXXXX";
+  struct drift_log log;
+  time_t now = 1000000000;
+  double rate;
+  int day, ok;
+
+  if (drift_scratch (path) != 0 || drift_scratch (adjtime) != 0)
+    return 2;
+  drift_path = path;
+  adjtime_path = adjtime;
+  drift_open (&log);
+
+  drift_set (&log, now);
+  for (day = 1; day <= 2; day++)
+    {
+      now += 24 * 60 * 60;
+      drift_measure (&log, now + 10, now);
+      drift_set (&log, now);
+    }
+  drift_list (&log);
+
+  rate = drift_rate (&log) * 24 * 60 * 60;
+  ok = log.count == 5 && drift_last (&log)->measurements == 2
+    && rate > 9.999 && rate < 10.001;
+
+  /* a -w that measured but couldn't set the CMOS keeps the adjustment time */
+  drift_measure (&log, now + 24 * 60 * 60 + 10, now + 24 * 60 * 60);
+  ok = ok && drift_last (&log)->last_adjust == now;
+  printf ("drift check %s\n", ok ? "passed" : "FAILED");
+
+  drift_close (&log);
+  unlink (path);
+  unlink (adjtime);
+  ok = drift_check_migration () && ok;
+  return ok ? 0 : 1;
+}
+
 int 
 main (int argc, char **argv, char **envp)
 {
   struct tm tm;
   time_t systime;
-  time_t last_time;
+  time_t last_time = 0;
   char arg;
-  double factor;
-  double not_adjusted;
+  double factor = 0;
+  double not_adjusted = 0;
   int adjustment = 0;
-  unsigned char save_control, save_freq_select;
   struct rtc_time rtc_tm;
+  struct drift_log log;
+  struct drift_record *last = NULL;
+  struct drift_record record;
 
-  while ((arg = getopt (argc, argv, "rwsuaDv")) != -1)
+  while ((arg = getopt (argc, argv, "rwsuadltDv")) != -1)
     {
       switch (arg)
 	{
@@ -193,6 +923,15 @@ main (int argc, char **argv, char **envp)
 	case 'a':
 	  adjustit = 1;
 	  break;
+	case 'd':
+	  daemonit = 1;
+	  break;
+	case 'l':
+	  listit = 1;
+	  break;
+	case 't':
+	  checkit = 1;
+	  break;
         case 'D':
 	  debug = 1;
 	  break;
@@ -204,89 +943,52 @@ main (int argc, char **argv, char **envp)
 	}
     }
 
-  if (readit + writeit + setit + adjustit > 1)
+  if (readit + writeit + setit + adjustit + daemonit + listit + checkit > 1)
     usage ();			/* only allow one of these */
 
-  if (!(readit | writeit | setit | adjustit))	/* default to read */
+  if (!(readit | writeit | setit | adjustit | daemonit | listit | checkit))	/* default to read */
     readit = 1;
 
+  if (checkit)
+    exit (drift_check ());
+
+  if (listit)
+    {
+      drift_open (&log);
+      drift_list (&log);
+      exit (0);
+    }
+
   rtc_init ();
 
-  if (adjustit)
-    {				/* Read adjustment parameters first */
-      FILE *adj;
-      if ((adj = fopen (ADJPATH, "r")) == NULL)
-	{
-	  perror (ADJPATH);
-	  exit (2);
-	}
-      if (fscanf (adj, "%lf %d %lf", &factor, &last_time, &not_adjusted) < 0)
-	{
-	  perror (ADJPATH);
-	  exit (2);
-	}
-      fclose (adj);
-      if (debug) printf ("Last adjustment done at %d seconds after 1/1/1970\n", last_time);
+  if (daemonit)
+    {
+      rtc_daemon ();
+      exit (0);
     }
 
-  if (readit || setit || adjustit)
+  if (adjustit || writeit)
     {
-      int i;
+      drift_open (&log);
+      last = drift_last (&log);
+    }
 
-/* The purpose of the "do" loop is called "low-risk programming" */
-/* In theory it should never run more than once */
-      if (ioctl(rtc_fd, RTCGET, &rtc_tm) < 0)
+  if (adjustit)
+    {				/* Read adjustment parameters first */
+      factor = -drift_rate (&log) * 24 * 60 * 60;
+      if (last != NULL)
 	{
-	  perror("ioctl(RTCGET)");
-	  exit (2);
+	  last_time = last->last_adjust;
+	  not_adjusted = last->not_adjusted;
 	}
-      
-      tm.tm_sec = rtc_tm.sec;
-      tm.tm_min = rtc_tm.min;
-      tm.tm_hour = rtc_tm.hour;
-      tm.tm_wday = rtc_tm.dow - 1;
-      tm.tm_mday = rtc_tm.dom ;
-      tm.tm_mon = rtc_tm.month - 1;
-      tm.tm_year = rtc_tm.year - 1900;
-      tm.tm_isdst = -1;		/* don't know whether it's daylight */
+      if (debug) printf ("Last adjustment done at %ld seconds after 1/1/1970\n", (long) last_time);
+      if (debug) printf ("Correcting %+.3f seconds per day\n", factor);
     }
 
   if (readit || setit || adjustit)
     {
-/*
- * mktime() assumes we're giving it local time.  If the CMOS clock
- * is in GMT, we have to set up TZ so mktime knows it.  tzset() gets
- * called implicitly by the time code, but only the first time.  When
- * changing the environment variable, better call tzset() explicitly.
- */
-      if (universal)
-	{
-	  char *zone;
-	  zone = (char *) getenv ("TZ");	/* save original time zone */
-	  (void) putenv ("TZ=");
-	  tzset ();
-	  systime = mktime (&tm);
-	  /* now put back the original zone */
-	  if (zone)
-	    {
-
-             char *zonebuf;
-             zonebuf = malloc (strlen (zone) + 4);
-             strcpy (zonebuf, "TZ=");
-             strcpy (zonebuf+3, zone);
-             putenv (zonebuf);
-             free (zonebuf);
-	    }
-	  else
-	    {			/* wasn't one, so clear it */
-	      putenv ("TZ");
-	    }
-	  tzset ();
-	}
-      else
-	{
-	  systime = mktime (&tm);
-	}
+      rtc_read_tm (&tm);
+      systime = rtc_mktime (&tm);
       if (debug) printf ("Number of seconds since 1/1/1970 is %d\n", systime);
     }
 
@@ -310,16 +1012,7 @@ main (int argc, char **argv, char **envp)
 
       if (adjustit)
 	{			/* the actual adjustment */
-	  double exact_adjustment;
-
-	  exact_adjustment = ((double) (systime - last_time))
-	    * factor / (24 * 60 * 60)
-	    + not_adjusted;
-	  if (exact_adjustment > 0)
-	    adjustment = (int) (exact_adjustment + 0.5);
-	  else
-	    adjustment = (int) (exact_adjustment - 0.5);
-	  not_adjusted = exact_adjustment - (double) adjustment;
+	  adjustment = drift_adjustment (&log, systime, &not_adjusted);
 	  systime += adjustment;
 	  if (debug) {
 	     printf ("Time since last adjustment is %d seconds\n",
@@ -353,6 +1046,15 @@ main (int argc, char **argv, char **envp)
 #endif
     }
   
+  if (writeit && last != NULL && last->last_set != 0)
+    {
+      /* measure how far the CMOS drifted since it was last written */
+      struct tm rtc_now;
+
+      rtc_read_tm (&rtc_now);
+      drift_measure (&log, rtc_mktime (&rtc_now), time (NULL));
+    }
+
   if (writeit || (adjustit && adjustment != 0))
     {
       struct tm *tmp;
@@ -362,17 +1064,18 @@ main (int argc, char **argv, char **envp)
       else
 	tmp = localtime (&systime);
 
-      rtc_tm.sec = tmp->tm_sec;
-      rtc_tm.min = tmp->tm_min;
-      rtc_tm.hour = tmp->tm_hour;
-      rtc_tm.dow = tmp->tm_wday + 1;
-      rtc_tm.dom = tmp->tm_mday;
-      rtc_tm.month = tmp->tm_mon + 1;
-      rtc_tm.year = tmp->tm_year + 1900;
+      memset (&rtc_tm, 0, sizeof (rtc_tm));
+      rtc_tm.tm_sec = tmp->tm_sec;
+      rtc_tm.tm_min = tmp->tm_min;
+      rtc_tm.tm_hour = tmp->tm_hour;
+      rtc_tm.tm_wday = tmp->tm_wday;
+      rtc_tm.tm_mday = tmp->tm_mday;
+      rtc_tm.tm_mon = tmp->tm_mon;
+      rtc_tm.tm_year = tmp->tm_year;
 
-      if (ioctl(rtc_fd, RTCSET, &rtc_tm) < 0)
+      if (ioctl(rtc_fd, RTC_SET_TIME, &rtc_tm) < 0)
 	{
-	  perror("ioctl(RTCGET)");
+	  perror("ioctl(RTC_SET_TIME)");
 	  exit (2);
 	}
       
@@ -381,16 +1084,19 @@ main (int argc, char **argv, char **envp)
   else
     if (debug) printf ("CMOS clock unchanged.\n");
   /* Save data for next 'adjustit' call */
+  if (writeit)
+    drift_set (&log, systime);
   if (adjustit)
     {
-      FILE *adj;
-      if ((adj = fopen (ADJPATH, "w")) == NULL)
-	{
-	  perror (ADJPATH);
-	  exit (2);
-	}
-      fprintf (adj, "%f %d %f\n", factor, systime, not_adjusted);
-      fclose (adj);
+      memset (&record, 0, sizeof (record));
+      record.kind = DRIFT_ADJUST;
+      record.time = systime;
+      record.last_set = last ? last->last_set : 0;
+      record.last_adjust = systime;
+      record.error = adjustment;
+      record.not_adjusted = not_adjusted;
+      record.corrected = (last ? last->corrected : 0) + adjustment;
+      drift_append (&log, &record);
     }
   exit (0);
 }
\ No newline at end of file
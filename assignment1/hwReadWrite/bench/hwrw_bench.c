@@ -0,0 +1,432 @@
+/*
+ * hwrw_bench.c - measure the cost of the register access paths of hwReadWrite
+ *
+ * Every access path is timed for a number of batch sizes and access widths:
+ *   sysfs   one "r 1 <address>" write to /sys/kernel/hwReadWrite/result per register,
+ *           followed by a read of /sys/kernel/hwReadWrite/output
+ *   script  all registers of a batch as one newline separated script, one read of output
+ *   device  one pread() of the whole batch on /dev/hwrw
+ *   mmap    direct loads through an uncached mapping of /dev/hwrw
+ *   ioctl   one HWRW_IOC_TRANSACTION with a read operation per register
+ *
+ * With -s the paths run against the simulated register backend of the module on the
+ * host, so the benchmark also runs on a plain x86 Linux machine. The module logic of
+ * hwrw_core.c (the script parser, the handlers and the transactions) is linked in and
+ * does the same work as in the kernel. Every kernel crossing is modelled by a system
+ * call on /dev/zero that copies the same amount of data.
+ *
+ * Output is one line per path, width and batch size with the number of register
+ * operations per second and the latency percentiles of one batch in nanoseconds.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include "../hwReadWrite.h"
+
+#define RESULT_PATH	"/sys/kernel/hwReadWrite/result"
+#define OUTPUT_PATH	"/sys/kernel/hwReadWrite/output"
+#define DEVICE_PATH	"/dev/hwrw"
+
+#define MAX_BATCH	HWRW_MAX_OPS
+#define MAX_LIST	16
+#define SCRIPT_SIZE	1024	/* max_data of the module */
+#define OUTPUT_SIZE	4096
+
+/* Options */
+int simulate = 0;
+unsigned long base_address = 0x40028000;	/* GPIO block */
+unsigned long window_size = 0x1000;
+int iterations = 1000;
+int batches[MAX_LIST] = { 1, 8, 64 };
+int batch_count = 3;
+int widths[MAX_LIST] = { 4 };
+int width_count = 1;
+const char *path_list = "sysfs,script,device,mmap,ioctl";
+
+/* Open files, either the real ones or their simulated counterparts */
+int result_fd = -1;
+int output_fd = -1;
+int device_fd = -1;
+int null_fd = -1;
+volatile uint8_t *window = NULL;	/* mmap of /dev/hwrw, not used when simulating */
+
+struct path
+{
+  const char *name;
+  int any_width;		/* 1 when the path supports 8 and 16-bit accesses */
+  int (*run) (int batch, int width);	/* one batch, returns 0 on success */
+};
+
+void
+usage ()
+{
+  fprintf (stderr,
+    "hwrw_bench [-s] [-l latency] [-a address] [-n window size] [-i iterations]\n"
+    "           [-b batch,batch,...] [-w width,width,...] [-p path,path,...]\n"
+    "  s: simulate the register window on the host instead of using the module\n"
+    "  l: time every simulated register access takes in ns (default 0)\n"
+    "  a: physical address of the first register (default 0x%08lx)\n"
+    "  n: size of the register window in bytes (default 0x%lx)\n"
+    "  i: batches per measurement (default %d)\n"
+    "  b: batch sizes in registers (default 1,8,64, at most %d)\n"
+    "  w: access widths in bytes (default 4)\n"
+    "  p: access paths (default %s)\n",
+    base_address, window_size, iterations, MAX_BATCH, path_list);
+  exit (1);
+}
+
+int
+parse_list (const char *text, int *list, int min, int max)
+{
+  int count = 0;
+  char *end;
+
+  while (*text != '\0' && count < MAX_LIST)
+    {
+      long value = strtol (text, &end, 0);
+      if (end == text || value < min || value > max)
+	usage ();
+      list[count++] = value;
+      text = (*end == ',') ? end + 1 : end;
+    }
+  return count;
+}
+
+uint64_t
+now_ns ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long
+register_address (int index, int width)
+{
+  return base_address + ((unsigned long) index * width) % window_size;
+}
+
+/*
+ * Simulated write to the result attribute: the system call and copy of the write,
+ * then the script parser of the module itself
+ */
+int
+simulated_script (const char *script, size_t length)
+{
+  if (write (null_fd, script, length) < 0)
+    return -1;
+  return hwrw_run_script (script, length) < 0 ? -1 : 0;
+}
+
+int
+read_output (char *output)
+{
+  ssize_t size;
+
+  if (!simulate)
+    return pread (output_fd, output, OUTPUT_SIZE, 0) < 0 ? -1 : 0;
+
+  /* the output attribute of the module, then the system call and copy of the read */
+  size = hwrw_output_show (output);
+  return pread (null_fd, output, size, 0) < 0 ? -1 : 0;
+}
+
+int
+run_sysfs (int batch, int width)
+{
+  char command[32];
+  char output[OUTPUT_SIZE];
+  int i;
+
+  for (i = 0; i < batch; i++)
+    {
+      int length = snprintf (command, sizeof (command), "r 1 0x%08lx\n", register_address (i, width));
+      if (simulate)
+	{
+	  if (simulated_script (command, length) != 0)
+	    return -1;
+	}
+      else if (write (result_fd, command, length) != length)
+	return -1;
+      if (read_output (output) != 0)
+	return -1;
+    }
+  return 0;
+}
+
+int
+run_script (int batch, int width)
+{
+  char script[SCRIPT_SIZE];
+  char output[OUTPUT_SIZE];
+  int length = 0;
+  int i;
+
+  for (i = 0; i < batch; i++)
+    {
+      if (length + 16 > SCRIPT_SIZE)
+	return -1;
+      length += snprintf (script + length, SCRIPT_SIZE - length, "r 1 0x%08lx\n", register_address (i, width));
+    }
+  if (simulate)
+    {
+      if (simulated_script (script, length) != 0)
+	return -1;
+    }
+  else if (write (result_fd, script, length) != length)
+    return -1;
+  return read_output (output);
+}
+
+int
+run_device (int batch, int width)
+{
+  uint32_t values[MAX_BATCH];
+  size_t size = batch * sizeof (uint32_t);
+  int i;
+
+  if (!simulate)
+    return pread (device_fd, values, size, base_address) == (ssize_t) size ? 0 : -1;
+
+  /* the register reads of device_read, then the system call and copy of the pread */
+  for (i = 0; i < batch; i++)
+    values[i] = hwrw_read32 (base_address + i * sizeof (uint32_t));
+  return pread (null_fd, values, size, 0) == (ssize_t) size ? 0 : -1;
+}
+
+int
+run_mmap (int batch, int width)
+{
+  uint32_t sum = 0;
+  int i;
+
+  for (i = 0; i < batch; i++)
+    {
+      unsigned long address = register_address (i, width);
+
+      if (simulate)
+	{
+	  /* a load of the mapping is a bare bus access, without any kernel crossing */
+	  sum += hwrw_read (hwrw_translate (address), width);
+	  continue;
+	}
+      switch (width)
+	{
+	case 1:
+	  sum += *(volatile uint8_t *) (window + address - base_address);
+	  break;
+	case 2:
+	  sum += *(volatile uint16_t *) (window + address - base_address);
+	  break;
+	default:
+	  sum += *(volatile uint32_t *) (window + address - base_address);
+	  break;
+	}
+    }
+  return sum == 0xdeadbeef ? 1 : 0;	/* keep the loads alive */
+}
+
+int
+run_ioctl (int batch, int width)
+{
+  struct hwrw_op ops[MAX_BATCH];
+  struct hwrw_transaction transaction;
+  int i;
+
+  memset (ops, 0, batch * sizeof (ops[0]));
+  for (i = 0; i < batch; i++)
+    {
+      ops[i].op = HWRW_OP_READ;
+      ops[i].width = width;
+      ops[i].address = register_address (i, width);
+    }
+  transaction.ops = (uintptr_t) ops;
+  transaction.count = batch;
+  transaction.completed = 0;
+
+  if (!simulate)
+    return ioctl (device_fd, HWRW_IOC_TRANSACTION, &transaction);
+
+  /* the system call and copy in of the transaction, the operations, and the copy out */
+  if (write (null_fd, ops, batch * sizeof (ops[0])) < 0)
+    return -1;
+  if (hwrw_transaction_run (ops, batch, &transaction.completed) != 0)
+    return -1;
+  return pread (null_fd, ops, batch * sizeof (ops[0]), 0) < 0 ? -1 : 0;
+}
+
+struct path paths[] = {
+  { "sysfs", 0, run_sysfs },
+  { "script", 0, run_script },
+  { "device", 0, run_device },
+  { "mmap", 1, run_mmap },
+  { "ioctl", 1, run_ioctl },
+};
+
+int
+compare_u64 (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+void
+measure (const struct path *path, int batch, int width)
+{
+  uint64_t *latency = malloc (iterations * sizeof (uint64_t));
+  uint64_t total = 0;
+  int i;
+
+  if (latency == NULL)
+    {
+      perror ("malloc");
+      exit (2);
+    }
+  path->run (batch, width);	/* warm up */
+  for (i = 0; i < iterations; i++)
+    {
+      uint64_t start = now_ns ();
+      if (path->run (batch, width) < 0)
+	{
+	  printf ("%-7s %5d %5d  failed: %s\n", path->name, width, batch, strerror (errno));
+	  free (latency);
+	  return;
+	}
+      latency[i] = now_ns () - start;
+      total += latency[i];
+    }
+  qsort (latency, iterations, sizeof (uint64_t), compare_u64);
+
+  printf ("%-7s %5d %5d %12.0f %9llu %9llu %9llu %9llu\n",
+	  path->name, width, batch,
+	  (double) batch * iterations * 1e9 / (total ? total : 1),
+	  (unsigned long long) latency[iterations / 2],
+	  (unsigned long long) latency[iterations * 90 / 100],
+	  (unsigned long long) latency[iterations * 99 / 100],
+	  (unsigned long long) latency[iterations - 1]);
+  free (latency);
+}
+
+void
+open_real ()
+{
+  result_fd = open (RESULT_PATH, O_WRONLY);
+  output_fd = open (OUTPUT_PATH, O_RDONLY);
+  device_fd = open (DEVICE_PATH, O_RDWR);
+  if (device_fd >= 0)
+    {
+      void *mapping = mmap (NULL, window_size, PROT_READ | PROT_WRITE, MAP_SHARED, device_fd, base_address);
+      if (mapping != MAP_FAILED)
+	window = mapping;
+    }
+  if (result_fd < 0 || output_fd < 0 || device_fd < 0 || window == NULL)
+    fprintf (stderr, "hwReadWrite is not (completely) available, paths that need it will fail; use -s to simulate\n");
+}
+
+void
+open_simulated ()
+{
+  unsigned long i;
+  int result;
+
+  hwrw_backend_name = "sim";
+  hwrw_sim_base = base_address;
+  hwrw_sim_size = window_size < PAGE_SIZE ? PAGE_SIZE : window_size;
+  result = hwrw_backend_init ();
+  if (result != 0)
+    {
+      fprintf (stderr, "sim backend could not be initialized: %s\n", strerror (-result));
+      exit (2);
+    }
+  for (i = 0; i < window_size; i += 4)
+    hwrw_write (hwrw_translate (base_address + i), base_address + i, 4);
+
+  null_fd = open ("/dev/zero", O_RDWR);
+  if (null_fd < 0)
+    {
+      perror ("/dev/zero");
+      exit (2);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  int arg;
+  unsigned int p;
+  int b;
+  int w;
+
+  while ((arg = getopt (argc, argv, "sl:a:n:i:b:w:p:")) != -1)
+    {
+      switch (arg)
+	{
+	case 's':
+	  simulate = 1;
+	  break;
+	case 'l':
+	  hwrw_sim_latency_ns = strtoul (optarg, NULL, 0);
+	  break;
+	case 'a':
+	  base_address = strtoul (optarg, NULL, 0);
+	  break;
+	case 'n':
+	  window_size = strtoul (optarg, NULL, 0);
+	  break;
+	case 'i':
+	  iterations = atoi (optarg);
+	  break;
+	case 'b':
+	  batch_count = parse_list (optarg, batches, 1, MAX_BATCH);
+	  break;
+	case 'w':
+	  width_count = parse_list (optarg, widths, 1, 4);
+	  break;
+	case 'p':
+	  path_list = optarg;
+	  break;
+	default:
+	  usage ();
+	}
+    }
+  if (iterations < 1 || window_size < 4 || (window_size & (window_size - 1)) != 0
+      || (base_address & (simulate ? PAGE_SIZE - 1 : 3)) != 0)
+    usage ();
+  for (w = 0; w < width_count; w++)
+    if (widths[w] == 3)
+      usage ();
+
+  if (simulate)
+    open_simulated ();
+  else
+    open_real ();
+
+  printf ("%-7s %5s %5s %12s %9s %9s %9s %9s\n", "path", "width", "batch", "ops/s", "p50 ns", "p90 ns", "p99 ns", "max ns");
+  for (p = 0; p < sizeof (paths) / sizeof (paths[0]); p++)
+    {
+      const char *found = strstr (path_list, paths[p].name);
+      size_t length = strlen (paths[p].name);
+
+      if (found == NULL || (found[length] != '\0' && found[length] != ','))
+	continue;
+      for (w = 0; w < width_count; w++)
+	{
+	  if (widths[w] != 4 && !paths[p].any_width)
+	    continue;
+	  for (b = 0; b < batch_count; b++)
+	    measure (&paths[p], batches[b], widths[w]);
+	}
+    }
+  return 0;
+}
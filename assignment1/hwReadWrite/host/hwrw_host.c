@@ -0,0 +1,175 @@
+/*
+ * hwrw_host.c - run the hwReadWrite module logic on a Linux host
+ *
+ * The script parser, the read/write handlers, the result ring and the statistics
+ * of hwrw_core.c are linked against the simulated register backend, so scripts
+ * can be tried and profiled without the board:
+ *
+ *   echo "w 0x40024000 0x222
+ *   r 4 0x40024000" | ./hwrw_host -S
+ *
+ * Every script is fed to the parser in pieces of at most max_data bytes, cut at a
+ * newline, just like a large echo to /sys/kernel/hwReadWrite/result. The output
+ * of every piece is printed the way /sys/kernel/hwReadWrite/output shows it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "../hwReadWrite.h"
+
+void
+usage ()
+{
+  fprintf (stderr,
+    "hwrw_host [-a address] [-n size] [-l latency] [-t level] [-R] [-S] [script ...]\n"
+    "  a: physical address of the simulated register window (default 0x%08lx)\n"
+    "  n: size of the simulated register window in bytes (default 0x%lx)\n"
+    "  l: time every register access takes in ns (default 0)\n"
+    "  t: trace level, like the trace_level module parameter (default 0)\n"
+    "  R: drain and print the result ring at the end\n"
+    "  S: enable the statistics and print them at the end\n"
+    "Without script files the script is read from stdin.\n",
+    hwrw_sim_base, hwrw_sim_size);
+  exit (1);
+}
+
+/*
+ * Runs a script in pieces of at most max_data bytes and prints their output
+ */
+int
+run (const char *script, size_t length)
+{
+  static char page[PAGE_SIZE];
+
+  while (length > 0)
+    {
+      size_t piece = length;
+      ssize_t size;
+
+      if (piece > max_data)
+	{
+	  piece = max_data;
+	  while (piece > 0 && script[piece - 1] != '\n')
+	    piece--;
+	  if (piece == 0)
+	    piece = max_data;
+	}
+      piece = hwrw_run_script (script, piece);
+      size = hwrw_output_show (page);
+      fwrite (page, 1, size, stdout);
+      script += piece;
+      length -= piece;
+    }
+  return 0;
+}
+
+int
+run_file (FILE *file)
+{
+  char *script = NULL;
+  size_t length = 0;
+  size_t size = 0;
+  size_t n;
+
+  do
+    {
+      if (length == size)
+	{
+	  size = size ? size * 2 : 4096;
+	  script = realloc (script, size);
+	  if (script == NULL)
+	    {
+	      perror ("realloc");
+	      exit (2);
+	    }
+	}
+      n = fread (script + length, 1, size - length, file);
+      length += n;
+    }
+  while (n > 0);
+
+  run (script, length);
+  free (script);
+  return 0;
+}
+
+int
+main (int argc, char **argv)
+{
+  static char page[PAGE_SIZE];
+  int drain_ring = 0;
+  int show_stats = 0;
+  int arg;
+  int result;
+
+  while ((arg = getopt (argc, argv, "a:n:l:t:RS")) != -1)
+    {
+      switch (arg)
+	{
+	case 'a':
+	  hwrw_sim_base = strtoul (optarg, NULL, 0);
+	  break;
+	case 'n':
+	  hwrw_sim_size = strtoul (optarg, NULL, 0);
+	  break;
+	case 'l':
+	  hwrw_sim_latency_ns = strtoul (optarg, NULL, 0);
+	  break;
+	case 't':
+	  es6_trace_level = atoi (optarg);
+	  break;
+	case 'R':
+	  drain_ring = 1;
+	  break;
+	case 'S':
+	  show_stats = 1;
+	  break;
+	default:
+	  usage ();
+	}
+    }
+
+  hwrw_backend_name = "sim";
+  result = hwrw_backend_init ();
+  if (result != 0)
+    {
+      fprintf (stderr, "sim backend could not be initialized: %s\n", strerror (-result));
+      exit (2);
+    }
+  hwrw_stats_enabled = show_stats;
+
+  if (optind == argc)
+    run_file (stdin);
+  for (; optind < argc; optind++)
+    {
+      FILE *file = fopen (argv[optind], "r");
+      if (file == NULL)
+	{
+	  perror (argv[optind]);
+	  exit (2);
+	}
+      run_file (file);
+      fclose (file);
+    }
+
+  if (drain_ring)
+    {
+      ssize_t size;
+      printf ("ring:\n");
+      while ((size = hwrw_ring_drain (page)) > 0)
+	fwrite (page, 1, size, stdout);
+    }
+  if (show_stats)
+    {
+      ssize_t size = hwrw_stats_show (page);
+      printf ("stats:\n");
+      if (size > 0)
+	fwrite (page, 1, size, stdout);
+    }
+
+  hwrw_backend_exit ();
+  return 0;
+}
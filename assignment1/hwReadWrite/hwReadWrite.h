@@ -0,0 +1,309 @@
+/**
+ * Internal interface between the parts of the hwReadWrite module
+ *   hwrw_main.c     sysfs files, /dev/hwrw, /dev/hwrw_sampler, module init and exit (kernel only)
+ *   hwrw_core.c     script parser, read/write handlers, result ring, statistics, transactions
+ *   hwrw_backend.c  the register backends: real MMIO through io_p2v, or simulated memory
+ *   hwrw_shadow.c   the shadow register cache
+ *   hwrw_ring.c     /dev/hwrw_ring, register operations through shared memory rings (kernel only)
+ * hwrw_core.c, hwrw_backend.c and hwrw_shadow.c also build on a Linux host, see hwrw_compat.h
+ * */
+#ifndef HWREADWRITE_H
+#define HWREADWRITE_H
+
+#include "hwrw_compat.h"
+#include "hwrw_ioctl.h"
+#include "es6_trace.h"
+
+#define max_data 1024
+#define max_line 80
+#define register_size 4
+
+/**
+ * A register backend translates a physical address into something ioread32/iowrite32
+ * accept, and models the cost of a bus access.
+ * translate: never fails, addresses the backend can not map end up in a scratch area
+ * pin, unpin: like translate, but the address stays valid until unpin, also in interrupt context (optional)
+ * latency_ns: extra time every access takes, 0 for real hardware
+ * mmap: maps a physical range into userspace for /dev/hwrw (kernel only)
+ * */
+struct hwrw_backend
+{
+	const char *name;
+	int (*init)(void);
+	void (*exit)(void);
+	void __iomem *(*translate)(unsigned long address);
+	void __iomem *(*pin)(unsigned long address);
+	void (*unpin)(unsigned long address);
+	unsigned long latency_ns;
+#ifdef __KERNEL__
+	int (*mmap)(struct vm_area_struct *vma);
+#endif
+};
+
+extern const struct hwrw_backend *hwrw_backend;
+
+/* settings of the backends, module parameters in the kernel */
+extern char *hwrw_backend_name;
+extern unsigned long hwrw_sim_base;
+extern unsigned long hwrw_sim_size;
+extern unsigned long hwrw_sim_latency_ns;
+
+int hwrw_backend_init(void);
+void hwrw_backend_exit(void);
+
+/**
+ * The mmio backend maps addresses outside the static peripheral windows with ioremap, and
+ * replaces those mappings when its cache is full. Every path that translates addresses and
+ * accesses registers runs between hwrw_access_begin and hwrw_access_end, a replaced mapping
+ * is only unmapped when no such path is running. Translating may sleep, so in interrupt
+ * context only pinned addresses can be used.
+ * */
+void hwrw_access_begin(void);
+void hwrw_access_end(void);
+void __iomem *hwrw_pin(unsigned long address);
+void hwrw_unpin(unsigned long address);
+
+static inline void __iomem *hwrw_translate(unsigned long address)
+{
+	return hwrw_backend->translate(address);
+}
+
+/**
+ * Reads a register of 1, 2 or 4 bytes wide at an address returned by hwrw_translate
+ * */
+static inline u32 hwrw_read(void __iomem *address, int width)
+{
+	if (unlikely(hwrw_backend->latency_ns != 0))
+	{
+		ndelay(hwrw_backend->latency_ns);
+	}
+	switch (width)
+	{
+	case 1:
+		return ioread8(address);
+	case 2:
+		return ioread16(address);
+	default:
+		return ioread32(address);
+	}
+}
+
+/**
+ * Writes a register of 1, 2 or 4 bytes wide at an address returned by hwrw_translate
+ * */
+static inline void hwrw_write(void __iomem *address, u32 value, int width)
+{
+	if (unlikely(hwrw_backend->latency_ns != 0))
+	{
+		ndelay(hwrw_backend->latency_ns);
+	}
+	switch (width)
+	{
+	case 1:
+		iowrite8(value, address);
+		break;
+	case 2:
+		iowrite16(value, address);
+		break;
+	default:
+		iowrite32(value, address);
+		break;
+	}
+}
+
+static inline u32 hwrw_read32(unsigned long address)
+{
+	return hwrw_read(hwrw_translate(address), register_size);
+}
+
+/**
+ * The shadow register cache, see hwrw_shadow.c
+ * read: 1 when the value was served from the cache, 0 when the register must be read from the bus
+ * fill: remembers a value read from the bus
+ * write: remembers a value, 1 when the register already has it and the bus write can be skipped
+ * sync: writes the remembered values back to the device, returns the number of registers written
+ * claim: keeps policies off [first, last], for writers that can't go through the cache,
+ *        -EBUSY when a register in it has a policy. release takes one claim back.
+ * */
+enum shadow_policy
+{
+	shadow_volatile,
+	shadow_cacheable,
+	shadow_write_only
+};
+
+#define shadow_max_registers 4096
+
+int hwrw_shadow_set_policy(u32 base, u32 count, enum shadow_policy policy);
+int hwrw_shadow_read(u32 address, u32 *value, unsigned int width);
+void hwrw_shadow_fill(u32 address, u32 value, unsigned int width);
+int hwrw_shadow_write(u32 address, u32 value, unsigned int width);
+void hwrw_shadow_flush(void);
+int hwrw_shadow_claim(u32 first, u32 last);
+void hwrw_shadow_release(u32 first, u32 last);
+u32 hwrw_shadow_sync(void);
+ssize_t hwrw_shadow_show(char *buffer);
+void hwrw_shadow_exit(void);
+
+/**
+ * Counters of /sys/kernel/hwReadWrite/stats, see hwrw_core.c
+ * */
+enum stats_phase
+{
+	phase_parse,
+	phase_translate,
+	phase_access,
+	phase_log,
+	phase_count
+};
+
+#define stats_buckets 32
+
+struct phase_stats
+{
+	u64 count;
+	u64 total_ns;
+	u32 histogram[stats_buckets];
+};
+
+struct hwrw_stats
+{
+	u64 scripts;
+	u64 commands;
+	u64 errors;
+	u64 registers_read;
+	u64 registers_written;
+	u64 bytes_read;
+	u64 bytes_written;
+	u64 device_reads;
+	u64 transactions;
+	u64 transaction_ops;
+	u64 map_hits;
+	u64 map_misses;
+	u64 map_evictions;
+	struct phase_stats phases[phase_count];
+};
+
+extern struct hwrw_stats hwrw_stats;
+extern int hwrw_stats_enabled;
+
+void hwrw_stats_add(u64 *counter, u64 amount);
+ssize_t hwrw_stats_show(char *buffer);
+void hwrw_stats_reset(void);
+
+/**
+ * A session is the state of one user of the module, see hwrw_core.c
+ * The sysfs files share hwrw_default_session, every open of /dev/hwrw has its own.
+ * lock: serializes the scripts and transactions of this session only
+ * output: PAGE_SIZE bytes of "<address> <value>" and "error <line>" lines
+ * pending: the start of a line that was not complete at the end of a write
+ * window_size: 0 when the session may access every register
+ * snapshots: the named register snapshots of the session, at most HWRW_MAX_SNAPSHOTS
+ * watch: the watch of a /dev/hwrw session, kernel only, see hwrw_main.c
+ * */
+struct hwrw_snapshot
+{
+	char name[HWRW_SNAPSHOT_NAME];
+	u32 base;
+	u32 count;
+	struct hwrw_snapshot *next;
+	u32 values[0];
+};
+
+struct hwrw_watch_state;
+
+struct hwrw_session
+{
+	struct mutex lock;
+	char *output;
+	size_t output_size;
+	char pending[max_line + 1];
+	size_t pending_size;
+	int line_number;
+	u32 window_base;
+	u32 window_size;
+	struct hwrw_session_stats stats;
+	struct hwrw_session *next_window;	/* list of the sessions that have a window */
+	struct hwrw_snapshot *snapshots;
+	unsigned int snapshot_count;
+	struct hwrw_watch_state *watch;
+	s64 wait_deadline;	/* until when the "x" commands of the current script may wait */
+};
+
+extern struct hwrw_session hwrw_default_session;
+
+struct hwrw_session *hwrw_session_create(void);
+void hwrw_session_destroy(struct hwrw_session *session);
+int hwrw_session_set_window(struct hwrw_session *session, u32 base, u32 size);
+int hwrw_session_allowed(struct hwrw_session *session, unsigned long address, unsigned long size);
+void hwrw_session_count(struct hwrw_session *session, u64 *counter, u64 amount);
+void hwrw_session_free_snapshots(struct hwrw_session *session);
+
+/**
+ * Runs a complete script, the output of the session is replaced by its results
+ * return value: the number of bytes handled, at most max_data
+ * */
+ssize_t hwrw_session_run_script(struct hwrw_session *session, const char *buffer, size_t count);
+
+/**
+ * Runs the complete lines of buffer and keeps an incomplete last line for the next write,
+ * results are appended to the output of the session
+ * */
+ssize_t hwrw_session_write(struct hwrw_session *session, const char *buffer, size_t count);
+
+/**
+ * Moves at most size bytes of output into buffer
+ * return value: the number of bytes moved
+ * */
+size_t hwrw_session_take_output(struct hwrw_session *session, char *buffer, size_t size);
+
+/**
+ * Runs count transaction operations atomically with respect to scripts and other transactions
+ * completed: set to the number of operations that were executed
+ * return value: 0 on success, or the error of the first operation that failed
+ * */
+int hwrw_session_transaction(struct hwrw_session *session, struct hwrw_op *ops, u32 count, u32 *completed);
+
+/**
+ * Runs a burst capture, see hwrw_ioctl.h
+ * buffer: receives the stream, capture->size bytes
+ * return value: 0 on success, -EINVAL for a bad request, -EPERM when the register is outside
+ *               the window of the session
+ * */
+int hwrw_session_capture(struct hwrw_session *session, struct hwrw_capture *capture, u8 *buffer);
+
+/**
+ * Compares a snapshot with the registers, see hwrw_ioctl.h
+ * records: receives at most max_records records, count is set to the number stored
+ * return value: the number of registers that changed, -ENOENT when there is no such snapshot,
+ *               -EPERM when its range is no longer in the window of the session
+ * */
+int hwrw_session_diff(struct hwrw_session *session, const char *name, struct hwrw_diff_record *records, u32 max_records, u32 *count);
+
+/**
+ * Stored programs, see hwrw_ioctl.h and hwrw_core.c
+ * load: return value: the handle, -EINVAL with error_line set for a syntax error, -ENOSPC
+ *       when HWRW_MAX_PROGRAMS are loaded, or another negative error code
+ * free: return value: 0, or -ENOENT when there is no such program
+ * */
+int hwrw_program_load(const char *name, const char *text, size_t size, u32 *error_line);
+int hwrw_program_free(u32 handle);
+ssize_t hwrw_programs_show(char *buffer);
+void hwrw_programs_exit(void);
+
+/**
+ * Registers and removes /dev/hwrw_ring, see hwrw_ring.c
+ * */
+int hwrw_ring_init(void);
+void hwrw_ring_exit(void);
+
+/**
+ * The text protocol and its results for the default session, see hwrw_core.c
+ * The show and drain functions fill at most PAGE_SIZE bytes.
+ * */
+ssize_t hwrw_run_script(const char *buffer, size_t count);
+ssize_t hwrw_output_show(char *buffer);
+ssize_t hwrw_ring_drain(char *buffer);
+int hwrw_transaction_run(struct hwrw_op *ops, u32 count, u32 *completed);
+
+#endif
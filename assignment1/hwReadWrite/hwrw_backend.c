@@ -0,0 +1,519 @@
+/**
+ * hwrw_backend.c - register backends of hwReadWrite
+ *   mmio  the real LPC3250 registers through the static io_p2v mapping, other physical
+ *         addresses through ioremap mappings that are made on demand and cached (kernel only)
+ *   sim   a memory backed register window with a configurable latency per access,
+ *         used to run and benchmark the module without the board
+ * The backend is chosen when the module is loaded, e.g. insmod hwReadWrite.ko backend=sim sim_latency_ns=200
+ * */
+#include "hwReadWrite.h"
+
+#ifdef __KERNEL__
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/hardirq.h>
+#include <linux/workqueue.h>
+#endif
+
+const struct hwrw_backend *hwrw_backend = NULL;
+
+#ifdef __KERNEL__
+char *hwrw_backend_name = "mmio";
+#else
+char *hwrw_backend_name = "sim";
+#endif
+unsigned long hwrw_sim_base = 0x40000000;
+unsigned long hwrw_sim_size = 0x00100000;
+unsigned long hwrw_sim_latency_ns = 0;
+
+module_param_named(backend, hwrw_backend_name, charp, S_IRUGO);
+MODULE_PARM_DESC(backend, "register backend: mmio (default) or sim");
+module_param_named(sim_base, hwrw_sim_base, ulong, S_IRUGO);
+MODULE_PARM_DESC(sim_base, "physical address of the simulated register window (default 0x40000000)");
+module_param_named(sim_size, hwrw_sim_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(sim_size, "size of the simulated register window in bytes (default 0x100000)");
+module_param_named(sim_latency_ns, hwrw_sim_latency_ns, ulong, S_IRUGO);
+MODULE_PARM_DESC(sim_latency_ns, "time every simulated register access takes (default 0)");
+
+#ifdef __KERNEL__
+
+/**
+ * Physical to virtual and virtual to physical address mapping macros
+ * */
+#define IO_BASE		0xF0000000
+#define io_p2v(x) 	(IO_BASE | (((x) & 0xff000000) >> 4) | ((x) & 0x000fffff))
+#define io_v2p(x) 	((((x) & 0x0ff00000) << 4) | ((x) & 0x000fffff))
+
+/**
+ * Physical peripheral windows that may be mapped into userspace with mmap
+ * These are the blocks the platform maps statically, so io_p2v works for them too
+ * */
+struct mmap_window
+{
+	unsigned long start;
+	unsigned long size;
+	const char *name;
+};
+
+static const struct mmap_window mmap_windows[] = {
+	{ 0x20000000, 0x00080000, "AHB0 (SLC, SSP, SPI, I2S, SD)" },
+	{ 0x30000000, 0x00080000, "AHB1 (DMA, USB, LCD, ETH, EMC)" },
+	{ 0x40000000, 0x00100000, "FAB/APB (clocks, GPIO, timers, RTC, UARTs)" },
+};
+
+static int mmio_static(unsigned long address)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mmap_windows); i++)
+	{
+		if (address - mmap_windows[i].start < mmap_windows[i].size)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Addresses outside the static windows are mapped with ioremap, in chunks of map_chunk_size
+ * bytes. The mappings are kept in a cache of at most map_entries chunks: a small hash table
+ * finds them, and when the cache is full the least recently used mapping is replaced.
+ * Pinned mappings are never replaced, the sampler uses them from interrupt context.
+ * A replaced mapping may still be in use by a path that translated before, so it is moved to
+ * map_retired and only unmapped by map_retire_work once map_users has dropped to 0.
+ * */
+#define map_chunk_shift	16
+#define map_chunk_size	(1UL << map_chunk_shift)
+#define map_hash_size	64
+
+static unsigned int map_entries = 32;
+module_param(map_entries, uint, S_IRUGO);
+MODULE_PARM_DESC(map_entries, "number of 64kB ioremap mappings the mmio backend keeps (default 32)");
+
+struct map_entry
+{
+	unsigned long chunk;
+	void __iomem *virtual;
+	unsigned int pinned;
+	struct hlist_node hash;
+	struct list_head lru;
+};
+
+static struct hlist_head map_hash[map_hash_size];
+static LIST_HEAD(map_lru);		/* most recently used first */
+static LIST_HEAD(map_retired);
+static unsigned int map_count = 0;
+static DEFINE_SPINLOCK(map_lock);	/* protects all of the above */
+static atomic_t map_users = ATOMIC_INIT(0);
+static u32 map_scratch[2];
+
+static void map_retire(struct work_struct *work);
+static DECLARE_WORK(map_retire_work, map_retire);
+
+/**
+ * Looks up the mapping of a chunk, must be called with map_lock held
+ * */
+static struct map_entry *map_lookup(unsigned long chunk)
+{
+	struct map_entry *entry;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(entry, node, &map_hash[chunk & (map_hash_size - 1)], hash)
+	{
+		if (entry->chunk == chunk)
+		{
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Retires the least recently used unpinned mappings until the cache fits in map_entries,
+ * must be called with map_lock held
+ * */
+static void map_evict(void)
+{
+	struct map_entry *entry, *previous;
+
+	list_for_each_entry_safe_reverse(entry, previous, &map_lru, lru)
+	{
+		if (map_count <= map_entries)
+		{
+			break;
+		}
+		if (entry->pinned != 0)
+		{
+			continue;
+		}
+		hlist_del(&entry->hash);
+		list_move(&entry->lru, &map_retired);
+		map_count--;
+		hwrw_stats_add(&hwrw_stats.map_evictions, 1);
+		es6_trace_debug("map_evict", "address=0x%08lx", entry->chunk << map_chunk_shift);
+	}
+}
+
+static void map_retire(struct work_struct *work)
+{
+	LIST_HEAD(retired);
+	struct map_entry *entry, *next;
+
+	spin_lock(&map_lock);
+	if (atomic_read(&map_users) == 0)
+	{
+		list_splice_init(&map_retired, &retired);
+	}
+	spin_unlock(&map_lock);
+
+	list_for_each_entry_safe(entry, next, &retired, lru)
+	{
+		iounmap(entry->virtual);
+		kfree(entry);
+	}
+}
+
+/**
+ * Translates an address through the mapping cache, mapping its chunk when it is not cached yet
+ * pin: 1 to pin the mapping, 0 to only use it
+ * return value: the virtual address, or map_scratch when the chunk could not be mapped
+ * */
+static void __iomem *map_translate(unsigned long address, unsigned int pin)
+{
+	unsigned long chunk = address >> map_chunk_shift;
+	unsigned long offset = address & (map_chunk_size - 1);
+	struct map_entry *entry;
+	struct map_entry *new_entry;
+	void __iomem *virtual;
+
+	spin_lock(&map_lock);
+	entry = map_lookup(chunk);
+	if (entry != NULL)
+	{
+		list_move(&entry->lru, &map_lru);
+		entry->pinned += pin;
+		virtual = entry->virtual + offset;
+		spin_unlock(&map_lock);
+		hwrw_stats_add(&hwrw_stats.map_hits, 1);
+		return virtual;
+	}
+	spin_unlock(&map_lock);
+
+	if (in_interrupt())
+	{
+		es6_trace_error("map_interrupt", "address=0x%08lx", address);
+		return (void __iomem *)map_scratch;
+	}
+
+	/* ioremap may sleep, so map without the lock and look again afterwards */
+	new_entry = kmalloc(sizeof(*new_entry), GFP_KERNEL);
+	if (new_entry == NULL)
+	{
+		return (void __iomem *)map_scratch;
+	}
+	new_entry->virtual = ioremap(chunk << map_chunk_shift, map_chunk_size);
+	if (new_entry->virtual == NULL)
+	{
+		es6_trace_error("map_failed", "address=0x%08lx", address);
+		kfree(new_entry);
+		return (void __iomem *)map_scratch;
+	}
+	new_entry->chunk = chunk;
+	new_entry->pinned = 0;
+	hwrw_stats_add(&hwrw_stats.map_misses, 1);
+
+	spin_lock(&map_lock);
+	entry = map_lookup(chunk);
+	if (entry == NULL)
+	{
+		entry = new_entry;
+		new_entry = NULL;
+		hlist_add_head(&entry->hash, &map_hash[chunk & (map_hash_size - 1)]);
+		list_add(&entry->lru, &map_lru);
+		map_count++;
+		map_evict();
+	}
+	else
+	{
+		list_move(&entry->lru, &map_lru);
+	}
+	entry->pinned += pin;
+	virtual = entry->virtual + offset;
+	spin_unlock(&map_lock);
+
+	if (new_entry != NULL)
+	{
+		/* another path mapped the chunk in the meantime, nobody has seen this mapping */
+		iounmap(new_entry->virtual);
+		kfree(new_entry);
+	}
+	return virtual;
+}
+
+static void __iomem *mmio_translate(unsigned long address)
+{
+	if (mmio_static(address))
+	{
+		return (void __iomem *)io_p2v(address);
+	}
+	return map_translate(address, 0);
+}
+
+static void __iomem *mmio_pin(unsigned long address)
+{
+	void __iomem *virtual;
+
+	if (mmio_static(address))
+	{
+		return (void __iomem *)io_p2v(address);
+	}
+	hwrw_access_begin();
+	virtual = map_translate(address, 1);
+	hwrw_access_end();
+	return virtual;
+}
+
+static void mmio_unpin(unsigned long address)
+{
+	struct map_entry *entry;
+
+	if (mmio_static(address))
+	{
+		return;
+	}
+	spin_lock(&map_lock);
+	entry = map_lookup(address >> map_chunk_shift);
+	if (entry != NULL && entry->pinned != 0)
+	{
+		entry->pinned--;
+	}
+	spin_unlock(&map_lock);
+}
+
+static void mmio_exit(void)
+{
+	struct map_entry *entry, *next;
+	int i;
+
+	flush_scheduled_work();
+	list_splice_init(&map_retired, &map_lru);
+	list_for_each_entry_safe(entry, next, &map_lru, lru)
+	{
+		iounmap(entry->virtual);
+		kfree(entry);
+	}
+	INIT_LIST_HEAD(&map_lru);
+	for (i = 0; i < map_hash_size; i++)
+	{
+		INIT_HLIST_HEAD(&map_hash[i]);
+	}
+	map_count = 0;
+}
+
+/**
+ * Maps a physical peripheral range uncached, so loads and stores hit the registers
+ * directly and see the same values as ioread32/iowrite32 on io_p2v(address).
+ * Only ranges that fall completely inside one of mmap_windows can be mapped.
+ * */
+static int mmio_mmap(struct vm_area_struct *vma)
+{
+	int i;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long start_address = vma->vm_pgoff << PAGE_SHIFT;
+
+	if ((vma->vm_pgoff >> (32 - PAGE_SHIFT)) != 0)
+	{
+		return -EINVAL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(mmap_windows); i++)
+	{
+		const struct mmap_window *window = &mmap_windows[i];
+
+		if (start_address >= window->start &&
+		    size <= window->size &&
+		    start_address - window->start <= window->size - size)
+		{
+			break;
+		}
+	}
+	if (i == ARRAY_SIZE(mmap_windows))
+	{
+		es6_trace_error("mmap_denied", "address=0x%08lx size=%lu", start_address, size);
+		return -EPERM;
+	}
+
+	vma->vm_flags |= VM_IO | VM_RESERVED;
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+
+	if (io_remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff, size, vma->vm_page_prot) != 0)
+	{
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+static const struct hwrw_backend mmio_backend = {
+	.name = "mmio",
+	.exit = mmio_exit,
+	.translate = mmio_translate,
+	.pin = mmio_pin,
+	.unpin = mmio_unpin,
+	.mmap = mmio_mmap,
+};
+
+#endif /* __KERNEL__ */
+
+/**
+ * The simulated window is plain memory. Accesses outside of it go to a scratch word,
+ * so reads there return whatever was last written outside the window.
+ * */
+static u8 *sim_memory = NULL;
+static u32 sim_scratch[2];
+
+static void __iomem *sim_translate(unsigned long address)
+{
+	unsigned long offset = address - hwrw_sim_base;
+
+	if (address < hwrw_sim_base || offset >= hwrw_sim_size || hwrw_sim_size - offset < register_size)
+	{
+		return (void __iomem *)sim_scratch;
+	}
+	return (void __iomem *)(sim_memory + offset);
+}
+
+static int sim_init(void)
+{
+	if (hwrw_sim_size < register_size || (hwrw_sim_size & (PAGE_SIZE - 1)) != 0 || (hwrw_sim_base & (PAGE_SIZE - 1)) != 0)
+	{
+		printk(KERN_INFO "sim_base and sim_size must be multiples of %lu\n", (unsigned long)PAGE_SIZE);
+		return -EINVAL;
+	}
+#ifdef __KERNEL__
+	/* vmalloc_user memory is zeroed and can be mapped into userspace */
+	sim_memory = vmalloc_user(hwrw_sim_size);
+#else
+	sim_memory = calloc(1, hwrw_sim_size);
+#endif
+	if (sim_memory == NULL)
+	{
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void sim_exit(void)
+{
+	vfree(sim_memory);
+	sim_memory = NULL;
+}
+
+#ifdef __KERNEL__
+/**
+ * Maps a part of the simulated window, the mmap offset is the simulated physical address
+ * */
+static int sim_mmap(struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long start_address = vma->vm_pgoff << PAGE_SHIFT;
+
+	if (start_address < hwrw_sim_base || start_address - hwrw_sim_base > hwrw_sim_size ||
+	    size > hwrw_sim_size - (start_address - hwrw_sim_base))
+	{
+		return -EPERM;
+	}
+	return remap_vmalloc_range(vma, sim_memory, (start_address - hwrw_sim_base) >> PAGE_SHIFT);
+}
+#endif
+
+static struct hwrw_backend sim_backend = {
+	.name = "sim",
+	.init = sim_init,
+	.exit = sim_exit,
+	.translate = sim_translate,
+#ifdef __KERNEL__
+	.mmap = sim_mmap,
+#endif
+};
+
+void hwrw_access_begin(void)
+{
+#ifdef __KERNEL__
+	atomic_inc(&map_users);
+#endif
+}
+
+void hwrw_access_end(void)
+{
+#ifdef __KERNEL__
+	/* the last path out unmaps what was replaced while it ran */
+	if (atomic_dec_and_test(&map_users) && !list_empty(&map_retired))
+	{
+		schedule_work(&map_retire_work);
+	}
+#endif
+}
+
+void __iomem *hwrw_pin(unsigned long address)
+{
+	if (hwrw_backend->pin != NULL)
+	{
+		return hwrw_backend->pin(address);
+	}
+	return hwrw_backend->translate(address);
+}
+
+void hwrw_unpin(unsigned long address)
+{
+	if (hwrw_backend->unpin != NULL)
+	{
+		hwrw_backend->unpin(address);
+	}
+}
+
+/**
+ * Selects the backend named by hwrw_backend_name and initializes it
+ * return value: 0 on success, or a negative error code
+ * */
+int hwrw_backend_init(void)
+{
+	const struct hwrw_backend *backend = NULL;
+	int result = 0;
+
+#ifdef __KERNEL__
+	if (strcmp(hwrw_backend_name, mmio_backend.name) == 0)
+	{
+		backend = &mmio_backend;
+	}
+#endif
+	if (strcmp(hwrw_backend_name, sim_backend.name) == 0)
+	{
+		sim_backend.latency_ns = hwrw_sim_latency_ns;
+		backend = &sim_backend;
+	}
+	if (backend == NULL)
+	{
+		printk(KERN_INFO "Unknown register backend %s\n", hwrw_backend_name);
+		return -EINVAL;
+	}
+
+	if (backend->init != NULL)
+	{
+		result = backend->init();
+	}
+	if (result == 0)
+	{
+		hwrw_backend = backend;
+	}
+	return result;
+}
+
+void hwrw_backend_exit(void)
+{
+	if (hwrw_backend != NULL && hwrw_backend->exit != NULL)
+	{
+		hwrw_backend->exit();
+	}
+	hwrw_backend = NULL;
+}
@@ -0,0 +1,191 @@
+/**
+ * The parts of the kernel API that hwrw_core.c and hwrw_backend.c use.
+ * In the kernel these are the real headers, on a Linux host (the host/ and bench/
+ * programs) they are mapped onto libc and pthreads, so the module logic can run
+ * and be profiled without the board.
+ * */
+#ifndef HWRW_COMPAT_H
+#define HWRW_COMPAT_H
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/io.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+
+#define hwrw_now_ns()	ktime_to_ns(ktime_get())
+
+#else /* host */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+#define __iomem
+#define __user
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+#define ACCESS_ONCE(x)	(*(volatile __typeof__(x) *)&(x))
+#define min_t(type, a, b)	((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define fls(x)		((x) ? 32 - __builtin_clz(x) : 0)
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE	4096UL
+#endif
+#define NSEC_PER_USEC	1000L
+#define S_IRUGO		(S_IRUSR | S_IRGRP | S_IROTH)
+
+#define KERN_INFO	""
+#define KERN_ERR	""
+#define KERN_DEBUG	""
+#define printk		printf
+
+/**
+ * Unlike strtoul, the kernel doesn't skip whitespace or take a sign, so neither do these:
+ * a parser that starts at the space in front of a number gets 0 on the host too
+ * */
+static inline unsigned long simple_strtoul(const char *text, char **end, unsigned int base)
+{
+	if (!isxdigit((unsigned char)*text))
+	{
+		if (end != NULL)
+		{
+			*end = (char *)text;
+		}
+		return 0;
+	}
+	return strtoul(text, end, base);
+}
+
+static inline long simple_strtol(const char *text, char **end, unsigned int base)
+{
+	if (*text == '-')
+	{
+		return -simple_strtoul(text + 1, end, base);
+	}
+	return simple_strtoul(text, end, base);
+}
+
+#define GFP_KERNEL	0
+#define kmalloc(size, flags)	malloc(size)
+#define kfree(pointer)		free((void *)(pointer))
+#define vmalloc(size)		malloc(size)
+#define vfree(pointer)		free((void *)(pointer))
+
+#define module_param(name, type, perm)
+#define module_param_named(name, variable, type, perm)
+#define MODULE_PARM_DESC(name, description)
+
+struct mutex
+{
+	pthread_mutex_t lock;
+};
+#define __MUTEX_INITIALIZER(name)	{ PTHREAD_MUTEX_INITIALIZER }
+#define DEFINE_MUTEX(name)	struct mutex name = __MUTEX_INITIALIZER(name)
+#define mutex_init(m)		pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_lock(m)		pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m)		pthread_mutex_unlock(&(m)->lock)
+
+struct rw_semaphore
+{
+	pthread_rwlock_t lock;
+};
+#define DECLARE_RWSEM(name)	struct rw_semaphore name = { PTHREAD_RWLOCK_INITIALIZER }
+#define down_read(s)		pthread_rwlock_rdlock(&(s)->lock)
+#define up_read(s)		pthread_rwlock_unlock(&(s)->lock)
+#define down_write(s)		pthread_rwlock_wrlock(&(s)->lock)
+#define up_write(s)		pthread_rwlock_unlock(&(s)->lock)
+
+typedef struct mutex spinlock_t;
+#define DEFINE_SPINLOCK(name)	DEFINE_MUTEX(name)
+#define spin_lock(l)		mutex_lock(l)
+#define spin_unlock(l)		mutex_unlock(l)
+
+/* registers are plain memory on the host */
+#define ioread8(a)		(*(volatile u8 *)(a))
+#define ioread16(a)		(*(volatile u16 *)(a))
+#define ioread32(a)		(*(volatile u32 *)(a))
+#define iowrite8(v, a)		(*(volatile u8 *)(a) = (v))
+#define iowrite16(v, a)		(*(volatile u16 *)(a) = (v))
+#define iowrite32(v, a)		(*(volatile u32 *)(a) = (v))
+
+#define cond_resched()		sched_yield()
+#define local_irq_save(flags)	((flags) = 0)
+#define local_irq_restore(flags)	((void)(flags))
+
+static inline s64 hwrw_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (s64)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static inline void ndelay(unsigned long ns)
+{
+	s64 end = hwrw_now_ns() + ns;
+
+	while (hwrw_now_ns() < end)
+	{
+	}
+}
+#define udelay(us)		ndelay((us) * NSEC_PER_USEC)
+#define msleep(ms)		usleep((ms) * 1000)
+
+static inline int vscnprintf(char *buffer, size_t size, const char *format, va_list args)
+{
+	int length;
+
+	if (size == 0)
+	{
+		return 0;
+	}
+	length = vsnprintf(buffer, size, format, args);
+	if (length < 0)
+	{
+		return 0;
+	}
+	return (size_t)length >= size ? (int)size - 1 : length;
+}
+
+static inline int scnprintf(char *buffer, size_t size, const char *format, ...)
+{
+	va_list args;
+	int length;
+
+	va_start(args, format);
+	length = vscnprintf(buffer, size, format, args);
+	va_end(args);
+	return length;
+}
+
+#endif /* __KERNEL__ */
+
+#endif
@@ -0,0 +1,1718 @@
+/**
+ * hwrw_core.c - the register access logic of hwReadWrite
+ * The text protocol of /sys/kernel/hwReadWrite/result and /dev/hwrw, the sessions, the
+ * result ring, the statistics and the ioctl transactions. Registers are only accessed
+ * through the backend in hwReadWrite.h, so this file builds in the kernel and on a Linux host.
+ * */
+#include "hwReadWrite.h"
+
+#define msg_param_offset 2
+
+/**
+ * The sysfs files share the default session, its output is the output of the last script
+ * written to result, readable from /sys/kernel/hwReadWrite/output.
+ *
+ * access_lock decides which sessions run at the same time. A session without a window may
+ * touch every register, so it holds access_lock for writing while it runs a script or a
+ * transaction: one at a time, like all users did before there were sessions. A session with
+ * a window holds it for reading, so sessions with windows run in parallel. Their windows
+ * can't overlap, so their transactions are still atomic with respect to everyone else.
+ * window_sessions lists the sessions with a window, it is protected by access_lock too.
+ * */
+static char default_output[PAGE_SIZE];
+
+struct hwrw_session hwrw_default_session = {
+	.lock = __MUTEX_INITIALIZER(hwrw_default_session.lock),
+	.output = default_output,
+};
+
+static DECLARE_RWSEM(access_lock);
+static struct hwrw_session *window_sessions = NULL;
+
+/**
+ * Every register read by a script is also stored in this ring, which is drained by
+ * reading /sys/kernel/hwReadWrite/ring. When the ring is full the oldest record is
+ * overwritten and counted in ring_lost.
+ * */
+#define ring_size 1024 /* records, must be a power of two */
+
+struct read_record
+{
+	u32 address;
+	u32 value;
+};
+
+static struct read_record ring[ring_size];
+static unsigned int ring_head = 0;
+static unsigned int ring_tail = 0;
+static unsigned int ring_lost = 0;
+static DEFINE_SPINLOCK(ring_lock);
+
+/**
+ * trace_level = 3 logs every register access again, like the first version of this module did
+ * */
+ES6_TRACE_DEFINE();
+
+/**
+ * Appends a formatted line to the output of a session, the output is truncated when the page is full
+ * */
+static void output_append(struct hwrw_session *session, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	session->output_size += vscnprintf(&session->output[session->output_size], PAGE_SIZE - session->output_size, format, args);
+	va_end(args);
+}
+
+/**
+ * Instrumentation of the access paths, see /sys/kernel/hwReadWrite/stats
+ * Every phase of a register access keeps a count, the total time and a log2 histogram:
+ * bucket n counts the phases that took [2^(n-1), 2^n) nanoseconds, bucket 0 those that took 0 ns.
+ * When hwrw_stats_enabled is 0 the only cost is one test per phase.
+ * */
+static const char *const phase_names[phase_count] = { "parse", "translate", "access", "log" };
+
+struct hwrw_stats hwrw_stats;
+int hwrw_stats_enabled = 0;
+static DEFINE_SPINLOCK(stats_lock);
+
+/**
+ * Returns the start time of a phase, or 0 when instrumentation is disabled
+ * */
+static inline u64 stats_start(void)
+{
+	if (likely(!hwrw_stats_enabled))
+	{
+		return 0;
+	}
+	return hwrw_now_ns();
+}
+
+/**
+ * Accounts a phase that was started with stats_start
+ * */
+static void stats_phase_end(enum stats_phase phase, u64 start)
+{
+	struct phase_stats *phase_stats = &hwrw_stats.phases[phase];
+	u64 elapsed;
+	unsigned int bucket;
+
+	if (likely(start == 0))
+	{
+		return;
+	}
+	elapsed = hwrw_now_ns() - start;
+	bucket = elapsed > 0xffffffffULL ? stats_buckets - 1 : fls((u32)elapsed);
+	if (bucket >= stats_buckets)
+	{
+		bucket = stats_buckets - 1;
+	}
+
+	spin_lock(&stats_lock);
+	phase_stats->count++;
+	phase_stats->total_ns += elapsed;
+	phase_stats->histogram[bucket]++;
+	spin_unlock(&stats_lock);
+}
+
+/**
+ * Adds amount to one of the counters of hwrw_stats when instrumentation is enabled
+ * */
+void hwrw_stats_add(u64 *counter, u64 amount)
+{
+	if (likely(!hwrw_stats_enabled))
+	{
+		return;
+	}
+	spin_lock(&stats_lock);
+	*counter += amount;
+	spin_unlock(&stats_lock);
+}
+
+/**
+ * Formats the statistics for /sys/kernel/hwReadWrite/stats
+ * buffer: receives one "<counter> <value>" line per counter, followed by one line per phase:
+ *         "<phase> <count> <total ns> <bucket 0> ... <bucket 31>"
+ * return value: the number of bytes written into buffer
+ * */
+ssize_t hwrw_stats_show(char *buffer)
+{
+	struct hwrw_stats *snapshot;
+	size_t size = 0;
+	int phase;
+	int bucket;
+
+	/* take a consistent copy first, so the lock is not held while formatting */
+	snapshot = kmalloc(sizeof(*snapshot), GFP_KERNEL);
+	if (snapshot == NULL)
+	{
+		return -ENOMEM;
+	}
+	spin_lock(&stats_lock);
+	memcpy(snapshot, &hwrw_stats, sizeof(*snapshot));
+	spin_unlock(&stats_lock);
+
+	size += scnprintf(&buffer[size], PAGE_SIZE - size,
+		"enabled %d\nscripts %llu\ncommands %llu\nerrors %llu\n"
+		"registers_read %llu\nregisters_written %llu\nbytes_read %llu\nbytes_written %llu\n"
+		"device_reads %llu\ntransactions %llu\ntransaction_ops %llu\n"
+		"map_hits %llu\nmap_misses %llu\nmap_evictions %llu\n",
+		hwrw_stats_enabled,
+		(unsigned long long)snapshot->scripts, (unsigned long long)snapshot->commands,
+		(unsigned long long)snapshot->errors, (unsigned long long)snapshot->registers_read,
+		(unsigned long long)snapshot->registers_written, (unsigned long long)snapshot->bytes_read,
+		(unsigned long long)snapshot->bytes_written, (unsigned long long)snapshot->device_reads,
+		(unsigned long long)snapshot->transactions, (unsigned long long)snapshot->transaction_ops,
+		(unsigned long long)snapshot->map_hits, (unsigned long long)snapshot->map_misses,
+		(unsigned long long)snapshot->map_evictions);
+
+	for (phase = 0; phase < phase_count; phase++)
+	{
+		const struct phase_stats *phase_stats = &snapshot->phases[phase];
+
+		size += scnprintf(&buffer[size], PAGE_SIZE - size, "%s %llu %llu", phase_names[phase],
+			(unsigned long long)phase_stats->count, (unsigned long long)phase_stats->total_ns);
+		for (bucket = 0; bucket < stats_buckets; bucket++)
+		{
+			size += scnprintf(&buffer[size], PAGE_SIZE - size, " %u", phase_stats->histogram[bucket]);
+		}
+		size += scnprintf(&buffer[size], PAGE_SIZE - size, "\n");
+	}
+
+	kfree(snapshot);
+	return size;
+}
+
+/**
+ * Clears all counters and histograms
+ * */
+void hwrw_stats_reset(void)
+{
+	spin_lock(&stats_lock);
+	memset(&hwrw_stats, 0, sizeof(hwrw_stats));
+	spin_unlock(&stats_lock);
+}
+
+/**
+ * Stores a register read in the ring, overwriting the oldest record when it is full
+ * */
+static void ring_push(u32 address, u32 value)
+{
+	spin_lock(&ring_lock);
+	if (ring_head - ring_tail == ring_size)
+	{
+		ring_tail++;
+		ring_lost++;
+	}
+	ring[ring_head & (ring_size - 1)].address = address;
+	ring[ring_head & (ring_size - 1)].value = value;
+	ring_head++;
+	spin_unlock(&ring_lock);
+}
+
+/**
+ * Sessions
+ * */
+
+/**
+ * Takes access_lock the way the window of the session requires, see the top of this file.
+ * The window can only change while access_lock is held for writing, so check it again
+ * once the lock is taken.
+ * return value: 1 when access_lock is held for writing, to be passed to session_end
+ * */
+static int session_begin(struct hwrw_session *session)
+{
+	int exclusive;
+
+	for (;;)
+	{
+		exclusive = ACCESS_ONCE(session->window_size) == 0;
+		if (exclusive)
+		{
+			down_write(&access_lock);
+		}
+		else
+		{
+			down_read(&access_lock);
+		}
+		if (exclusive == (session->window_size == 0))
+		{
+			break;
+		}
+		if (exclusive)
+		{
+			up_write(&access_lock);
+		}
+		else
+		{
+			up_read(&access_lock);
+		}
+	}
+	mutex_lock(&session->lock);
+	hwrw_access_begin();
+	return exclusive;
+}
+
+static void session_end(struct hwrw_session *session, int exclusive)
+{
+	hwrw_access_end();
+	mutex_unlock(&session->lock);
+	if (exclusive)
+	{
+		up_write(&access_lock);
+	}
+	else
+	{
+		up_read(&access_lock);
+	}
+}
+
+/**
+ * Allocates a session for an open of /dev/hwrw, without a window
+ * return value: the session, or NULL when out of memory
+ * */
+struct hwrw_session *hwrw_session_create(void)
+{
+	struct hwrw_session *session = kmalloc(sizeof(*session), GFP_KERNEL);
+
+	if (session == NULL)
+	{
+		return NULL;
+	}
+	memset(session, 0, sizeof(*session));
+	session->output = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (session->output == NULL)
+	{
+		kfree(session);
+		return NULL;
+	}
+	mutex_init(&session->lock);
+	session->line_number = 1;
+	return session;
+}
+
+void hwrw_session_destroy(struct hwrw_session *session)
+{
+	hwrw_session_set_window(session, 0, 0);
+	hwrw_session_free_snapshots(session);
+	kfree(session->output);
+	kfree(session);
+}
+
+/**
+ * Claims the window [base, base + size) for a session, or releases its window when size is 0
+ * return value: 0 on success, -EINVAL when the window wraps around, -EBUSY when it overlaps
+ *               the window of another session
+ * */
+int hwrw_session_set_window(struct hwrw_session *session, u32 base, u32 size)
+{
+	struct hwrw_session **link;
+	struct hwrw_session *other;
+	int result = 0;
+
+	if (size != 0 && base + (size - 1) < base)
+	{
+		return -EINVAL;
+	}
+
+	down_write(&access_lock);
+	for (other = window_sessions; other != NULL && size != 0; other = other->next_window)
+	{
+		if (other != session &&
+		    base <= other->window_base + (other->window_size - 1) &&
+		    other->window_base <= base + (size - 1))
+		{
+			result = -EBUSY;
+			break;
+		}
+	}
+	if (result == 0)
+	{
+		/* unlink first, then link again when the session keeps a window */
+		for (link = &window_sessions; *link != NULL; link = &(*link)->next_window)
+		{
+			if (*link == session)
+			{
+				*link = session->next_window;
+				break;
+			}
+		}
+		session->window_base = base;
+		session->window_size = size;
+		if (size != 0)
+		{
+			session->next_window = window_sessions;
+			window_sessions = session;
+		}
+	}
+	up_write(&access_lock);
+
+	return result;
+}
+
+/**
+ * Tells whether the range [address, address + size) lies in the window of a session,
+ * and counts the denied accesses. Must be called with session->lock held.
+ * */
+int hwrw_session_allowed(struct hwrw_session *session, unsigned long address, unsigned long size)
+{
+	unsigned long base = session->window_base;
+	unsigned long window_size = session->window_size;
+
+	if (window_size == 0 ||
+	    (address >= base && size <= window_size && address - base <= window_size - size))
+	{
+		return 1;
+	}
+	session->stats.denied++;
+	es6_trace_error("denied", "address=0x%08lx size=%lu window=0x%08lx+0x%lx", address, size, base, window_size);
+	return 0;
+}
+
+/**
+ * Adds amount to a counter of the session, for the paths that don't run under session->lock
+ * */
+void hwrw_session_count(struct hwrw_session *session, u64 *counter, u64 amount)
+{
+	mutex_lock(&session->lock);
+	*counter += amount;
+	mutex_unlock(&session->lock);
+}
+
+/**
+ * Handles the read function, "r <amount of registers> <start address>"
+ * The address goes up by one byte per register, as it always did for existing scripts. "r" in
+ * a stored program reads registers register_size bytes apart instead.
+ * buffer: the incoming message to be handled
+ * return value: 0, or -EPERM when a register is outside the window of the session
+ * */
+static int handle_read(struct hwrw_session *session, const char *buffer)
+{	
+	int i;	
+	char *endPtr;
+	int registers_to_read;
+	int start_address;
+	int result = 0;
+	u64 start = stats_start();
+
+	registers_to_read = simple_strtol(buffer, &endPtr, 10);
+	endPtr++; //Set endPtr ahead one position of the space in the message	
+	start_address = simple_strtol(endPtr, NULL, 16);
+	stats_phase_end(phase_parse, start);
+
+	es6_trace_debug("read_start", "count=%d address=0x%08x", registers_to_read, start_address);
+	
+	for(i = 0; i < registers_to_read; i++)
+	{
+		unsigned int output;
+		int current_address = start_address + i;
+		void __iomem *virtual_address;
+
+		if (!hwrw_session_allowed(session, (u32)current_address, register_size))
+		{
+			result = -EPERM;
+			break;
+		}
+
+		if (!hwrw_shadow_read(current_address, &output, register_size))
+		{
+			start = stats_start();
+			virtual_address = hwrw_translate(current_address);
+			stats_phase_end(phase_translate, start);
+
+			start = stats_start();
+			output = hwrw_read(virtual_address, register_size);
+			stats_phase_end(phase_access, start);
+
+			hwrw_shadow_fill(current_address, output, register_size);
+		}
+
+		start = stats_start();
+		es6_trace_debug("read", "address=0x%08x value=0x%08x", current_address, output);
+		ring_push(current_address, output);
+		output_append(session, "0x%08x 0x%08x\n", current_address, output);
+		stats_phase_end(phase_log, start);
+	}
+
+	if (i > 0)
+	{
+		session->stats.registers_read += i;
+		hwrw_stats_add(&hwrw_stats.registers_read, i);
+		hwrw_stats_add(&hwrw_stats.bytes_read, i * register_size);
+	}
+	return result;
+}
+
+/**
+ * Handles the write function
+ * buffer: the incoming message to be handled
+ * return value: 0, or -EPERM when the register is outside the window of the session
+ * */
+static int handle_write(struct hwrw_session *session, const char* buffer)
+{
+	char *endPtr;
+	int address_to_write;
+	int value_to_write;
+	void __iomem *virtual_address;
+	u64 start = stats_start();
+
+	address_to_write = simple_strtol(buffer, &endPtr, 16);
+	endPtr++; //Set endPtr ahead one position of the space in the message	
+	value_to_write = simple_strtol(endPtr, NULL, 16);
+	stats_phase_end(phase_parse, start);
+
+	if (!hwrw_session_allowed(session, (u32)address_to_write, register_size))
+	{
+		return -EPERM;
+	}
+	
+	start = stats_start();
+	es6_trace_debug("write", "address=0x%08x value=0x%08x", address_to_write, value_to_write);
+	stats_phase_end(phase_log, start);
+
+	if (hwrw_shadow_write(address_to_write, value_to_write, register_size))
+	{
+		return 0;
+	}
+
+	start = stats_start();
+	virtual_address = hwrw_translate(address_to_write);
+	stats_phase_end(phase_translate, start);
+
+	start = stats_start();
+	hwrw_write(virtual_address, value_to_write, register_size);
+	stats_phase_end(phase_access, start);
+
+	session->stats.registers_written++;
+	hwrw_stats_add(&hwrw_stats.registers_written, 1);
+	hwrw_stats_add(&hwrw_stats.bytes_written, register_size);
+	return 0;
+}
+
+/**
+ * Handles the policy function, "p <v|c|o> <start address> <amount of registers>"
+ * buffer: the incoming message to be handled
+ * return value: 0, -EINVAL for a bad policy or range, -EPERM when the range is outside the window
+ *               of the session, -EBUSY when it overlaps a range with a different size
+ * */
+static int handle_policy(struct hwrw_session *session, const char *buffer)
+{
+	char *endPtr;
+	enum shadow_policy policy;
+	u32 start_address;
+	u32 registers;
+
+	switch (buffer[0])
+	{
+	case 'v':
+		policy = shadow_volatile;
+		break;
+	case 'c':
+		policy = shadow_cacheable;
+		break;
+	case 'o':
+		policy = shadow_write_only;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (buffer[1] != ' ')
+	{
+		return -EINVAL;
+	}
+	start_address = simple_strtoul(&buffer[2], &endPtr, 16);
+	if (*endPtr != ' ')
+	{
+		return -EINVAL;
+	}
+	endPtr++; //Set endPtr ahead one position of the space in the message
+	registers = simple_strtoul(endPtr, NULL, 10);
+	if (registers == 0 || registers > shadow_max_registers)
+	{
+		return -EINVAL;
+	}
+	if (!hwrw_session_allowed(session, start_address, registers * register_size))
+	{
+		return -EPERM;
+	}
+	return hwrw_shadow_set_policy(start_address, registers, policy);
+}
+
+/**
+ * Snapshots read the registers straight from the bus, they show what the device holds and
+ * not what the shadow cache remembers.
+ * */
+#define diff_line_size 34	/* "0x%08x 0x%08x 0x%08x\n" and the '\0' */
+
+/**
+ * Copies the name at the start of buffer into name, which is padded with '\0'
+ * return value: the rest of buffer, or NULL when the name is empty or too long
+ * */
+static const char *parse_name(const char *buffer, char *name)
+{
+	size_t length = 0;
+
+	while (buffer[length] != '\0' && buffer[length] != ' ')
+	{
+		length++;
+	}
+	if (length == 0 || length >= HWRW_SNAPSHOT_NAME)
+	{
+		return NULL;
+	}
+	memset(name, 0, HWRW_SNAPSHOT_NAME);
+	memcpy(name, buffer, length);
+	return &buffer[length];
+}
+
+static struct hwrw_snapshot **snapshot_find(struct hwrw_session *session, const char *name)
+{
+	struct hwrw_snapshot **link;
+
+	for (link = &session->snapshots; *link != NULL; link = &(*link)->next)
+	{
+		if (strncmp((*link)->name, name, HWRW_SNAPSHOT_NAME) == 0)
+		{
+			break;
+		}
+	}
+	return link;
+}
+
+static void snapshot_count_reads(struct hwrw_session *session, u32 registers)
+{
+	session->stats.registers_read += registers;
+	hwrw_stats_add(&hwrw_stats.registers_read, registers);
+	hwrw_stats_add(&hwrw_stats.bytes_read, registers * register_size);
+}
+
+void hwrw_session_free_snapshots(struct hwrw_session *session)
+{
+	struct hwrw_snapshot *snapshot;
+
+	while ((snapshot = session->snapshots) != NULL)
+	{
+		session->snapshots = snapshot->next;
+		vfree(snapshot);
+	}
+	session->snapshot_count = 0;
+}
+
+/**
+ * Handles the capture function, "c <name> <amount of registers> <start address>"
+ * An existing snapshot with the same name is replaced, 0 registers removes it.
+ * buffer: the incoming message to be handled
+ * return value: 0, -EINVAL when it is not according to the protocol, -EPERM when the range is
+ *               outside the window of the session, -ENOSPC when the session has HWRW_MAX_SNAPSHOTS
+ * */
+static int handle_capture(struct hwrw_session *session, const char *buffer)
+{
+	char name[HWRW_SNAPSHOT_NAME];
+	char *endPtr;
+	u32 registers;
+	u32 start_address;
+	u32 i;
+	struct hwrw_snapshot **link;
+	struct hwrw_snapshot *snapshot;
+
+	buffer = parse_name(buffer, name);
+	if (buffer == NULL || *buffer != ' ')
+	{
+		return -EINVAL;
+	}
+	buffer++; //simple_strtoul doesn't skip the space in front of the amount
+	registers = simple_strtoul(buffer, &endPtr, 10);
+	if (endPtr == buffer)
+	{
+		return -EINVAL;
+	}
+	start_address = 0;
+	if (*endPtr == ' ')
+	{
+		start_address = simple_strtoul(endPtr + 1, NULL, 16);
+	}
+	else if (registers != 0)
+	{
+		return -EINVAL;	/* only "c <name> 0" goes without an address */
+	}
+	link = snapshot_find(session, name);
+
+	if (registers == 0)
+	{
+		if (*link == NULL)
+		{
+			return -ENOENT;
+		}
+		snapshot = *link;
+		*link = snapshot->next;
+		vfree(snapshot);
+		session->snapshot_count--;
+		return 0;
+	}
+	if (registers > HWRW_SNAPSHOT_MAX_REGS || (start_address & (register_size - 1)) != 0 ||
+	    start_address + registers * register_size - 1 < start_address)
+	{
+		return -EINVAL;
+	}
+	if (!hwrw_session_allowed(session, start_address, registers * register_size))
+	{
+		return -EPERM;
+	}
+	if (*link == NULL && session->snapshot_count == HWRW_MAX_SNAPSHOTS)
+	{
+		return -ENOSPC;
+	}
+
+	snapshot = vmalloc(sizeof(*snapshot) + registers * sizeof(u32));
+	if (snapshot == NULL)
+	{
+		return -ENOMEM;
+	}
+	memcpy(snapshot->name, name, sizeof(name));
+	snapshot->base = start_address;
+	snapshot->count = registers;
+	for (i = 0; i < registers; i++)
+	{
+		snapshot->values[i] = hwrw_read(hwrw_translate(start_address + i * register_size), register_size);
+	}
+	snapshot_count_reads(session, registers);
+	es6_trace_debug("capture", "name=%s count=%u address=0x%08x", snapshot->name, registers, start_address);
+
+	if (*link != NULL)
+	{
+		struct hwrw_snapshot *old_snapshot = *link;
+
+		snapshot->next = old_snapshot->next;
+		*link = snapshot;
+		vfree(old_snapshot);
+	}
+	else
+	{
+		snapshot->next = session->snapshots;
+		session->snapshots = snapshot;
+		session->snapshot_count++;
+	}
+	return 0;
+}
+
+/**
+ * Reads the range of a snapshot again. Every register that changed is passed to report until
+ * report returns 0 because it has no room left, reported registers take their new value.
+ * return value: the number of registers that changed
+ * */
+static u32 snapshot_diff(struct hwrw_session *session, struct hwrw_snapshot *snapshot,
+	int (*report)(void *context, u32 address, u32 old_value, u32 new_value), void *context)
+{
+	u32 changed = 0;
+	int room = 1;
+	u32 i;
+
+	for (i = 0; i < snapshot->count; i++)
+	{
+		u32 address = snapshot->base + i * register_size;
+		u32 value = hwrw_read(hwrw_translate(address), register_size);
+
+		if (value != snapshot->values[i])
+		{
+			changed++;
+			if (room && (room = report(context, address, snapshot->values[i], value)))
+			{
+				snapshot->values[i] = value;
+			}
+		}
+	}
+	snapshot_count_reads(session, snapshot->count);
+	es6_trace_debug("diff", "name=%s count=%u changed=%u", snapshot->name, snapshot->count, changed);
+	return changed;
+}
+
+/**
+ * Finds a snapshot whose range is still in the window of the session
+ * return value: 0, -ENOENT when there is no such snapshot, -EPERM when it is outside the window
+ * */
+static int snapshot_lookup(struct hwrw_session *session, const char *name, struct hwrw_snapshot **snapshot)
+{
+	*snapshot = *snapshot_find(session, name);
+	if (*snapshot == NULL)
+	{
+		return -ENOENT;
+	}
+	if (!hwrw_session_allowed(session, (*snapshot)->base, (*snapshot)->count * register_size))
+	{
+		return -EPERM;
+	}
+	return 0;
+}
+
+static int diff_output(void *context, u32 address, u32 old_value, u32 new_value)
+{
+	struct hwrw_session *session = context;
+
+	if (PAGE_SIZE - session->output_size < diff_line_size)
+	{
+		return 0;
+	}
+	output_append(session, "0x%08x 0x%08x 0x%08x\n", address, old_value, new_value);
+	return 1;
+}
+
+/**
+ * Handles the diff function, "d <name>"
+ * buffer: the incoming message to be handled
+ * return value: 0, -EINVAL when it is not according to the protocol, -ENOENT when there is no
+ *               such snapshot, -EPERM when its range is outside the window of the session
+ * */
+static int handle_diff(struct hwrw_session *session, const char *buffer)
+{
+	char name[HWRW_SNAPSHOT_NAME];
+	struct hwrw_snapshot *snapshot;
+	int result;
+
+	if (parse_name(buffer, name) == NULL)
+	{
+		return -EINVAL;
+	}
+	result = snapshot_lookup(session, name, &snapshot);
+	if (result == 0)
+	{
+		snapshot_diff(session, snapshot, diff_output, session);
+	}
+	return result;
+}
+
+static int handle_execute(struct hwrw_session *session, const char *buffer);
+
+/**
+ * Handles a single command line of a script
+ * line: one '\0' terminated command, without the newline
+ * return value: 0 when the command was executed, -EINVAL when it is not according to the protocol,
+ *               -EPERM when it accesses a register outside the window of the session
+ * */
+static int handle_command(struct hwrw_session *session, const char *line)
+{
+	if(strncmp(line, "r", 1) == 0)
+	{
+		return handle_read(session, &line[msg_param_offset]);
+	}
+	else if(strncmp(line, "w", 1) == 0)
+	{
+		return handle_write(session, &line[msg_param_offset]);
+	}
+	else if(strncmp(line, "c", 1) == 0)
+	{
+		return handle_capture(session, &line[msg_param_offset]);
+	}
+	else if(strncmp(line, "d", 1) == 0)
+	{
+		return handle_diff(session, &line[msg_param_offset]);
+	}
+	else if(strncmp(line, "p", 1) == 0)
+	{
+		return handle_policy(session, &line[msg_param_offset]);
+	}
+	else if(strncmp(line, "x", 1) == 0)
+	{
+		return handle_execute(session, &line[msg_param_offset]);
+	}
+	else if(strncmp(line, "f", 1) == 0 || strncmp(line, "s", 1) == 0)
+	{
+		/* the cache is shared, only a session that may touch every register flushes or syncs it */
+		if (session->window_size != 0)
+		{
+			return -EPERM;
+		}
+		if (line[0] == 'f')
+		{
+			hwrw_shadow_flush();
+		}
+		else
+		{
+			hwrw_shadow_sync();
+		}
+		return 0;
+	}
+	else
+	{
+		es6_trace_error("bad_command", "line=\"%s\"", line);
+		if (es6_trace_enabled(TRACE_INFO))
+		{
+			printk(KERN_INFO "If you wish to read:\n");
+			printk(KERN_INFO "\"r <amount of registers to read> <physical address of register to start at>\"\n");
+			printk(KERN_INFO "Example: echo \"r 8 0x40024000\"\n\n");
+			printk(KERN_INFO "If you wish to write:\n");
+			printk(KERN_INFO "\"w <physical address of register to write to> <value to write>\"\n");
+			printk(KERN_INFO "Example: echo \"w 0x40024000 0x222\"\n\n");
+			printk(KERN_INFO "If you wish to cache registers:\n");
+			printk(KERN_INFO "\"p <v(olatile)|c(acheable)|o (write-only)> <physical address of first register> <amount of registers>\"\n");
+			printk(KERN_INFO "\"f\" forgets the cached values, \"s\" writes the cached values back to the registers\n\n");
+			printk(KERN_INFO "If you wish to compare registers with an earlier snapshot:\n");
+			printk(KERN_INFO "\"c <name> <amount of registers> <physical address of register to start at>\" and later \"d <name>\"\n");
+			printk(KERN_INFO "If you wish to run a program loaded with HWRW_IOC_PROGRAM_LOAD:\n");
+			printk(KERN_INFO "\"x <handle>\", see /sys/kernel/hwReadWrite/programs\n\n");
+			printk(KERN_INFO "Several commands can be written at once, one per line\n");
+		}
+		return -EINVAL;
+	}
+}
+
+/**
+ * Runs the line collected in session->pending, empty lines are skipped
+ * */
+static void session_run_line(struct hwrw_session *session)
+{
+	if (session->pending_size > max_line)
+	{
+		es6_trace_error("line_too_long", "line=%d max=%d", session->line_number, max_line);
+		output_append(session, "error %d\n", session->line_number);
+	}
+	else if (session->pending_size > 0)
+	{
+		session->pending[session->pending_size] = '\0';
+		session->stats.commands++;
+		hwrw_stats_add(&hwrw_stats.commands, 1);
+		if (handle_command(session, session->pending) != 0)
+		{
+			session->stats.errors++;
+			hwrw_stats_add(&hwrw_stats.errors, 1);
+			output_append(session, "error %d\n", session->line_number);
+		}
+	}
+	session->pending_size = 0;
+	session->line_number++;
+}
+
+/**
+ * The time until which the polls and delays of a transaction that starts now may wait
+ * */
+static inline s64 transaction_wait_deadline(void)
+{
+	return hwrw_now_ns() + (s64)HWRW_MAX_TIMEOUT_US * NSEC_PER_USEC;
+}
+
+/**
+ * Runs every newline separated command of buffer back to back. The start of a line that
+ * doesn't end in buffer is kept in session->pending, lines that are too long are only
+ * reported once their newline arrives. Must be called between session_begin and session_end.
+ * All stored programs the commands run share one wait deadline, like a transaction.
+ * */
+static void session_feed(struct hwrw_session *session, const char *buffer, size_t count)
+{
+	const char *line_start = buffer;
+	const char *buffer_end = buffer + count;
+
+	session->stats.scripts++;
+	hwrw_stats_add(&hwrw_stats.scripts, 1);
+	session->wait_deadline = transaction_wait_deadline();
+
+	while (line_start < buffer_end)
+	{
+		const char *line_end = memchr(line_start, '\n', buffer_end - line_start);
+		size_t line_length = (line_end != NULL ? line_end : buffer_end) - line_start;
+
+		if (session->pending_size + line_length > max_line)
+		{
+			session->pending_size = max_line + 1;	/* too long, skip the rest of the line */
+		}
+		else
+		{
+			memcpy(&session->pending[session->pending_size], line_start, line_length);
+			session->pending_size += line_length;
+		}
+
+		if (line_end == NULL)
+		{
+			break;
+		}
+		session_run_line(session);
+		line_start = line_end + 1;
+	}
+}
+
+ssize_t hwrw_session_run_script(struct hwrw_session *session, const char *buffer, size_t count)
+{
+	size_t used_buffer_size = count;
+	int exclusive;
+
+    if ( count > max_data )
+    {
+		used_buffer_size = max_data;
+		es6_trace_error("script_too_large", "max=%d count=%zu", max_data, count);
+	}
+
+	exclusive = session_begin(session);
+	session->output_size = 0;
+	session->pending_size = 0;
+	session->line_number = 1;
+	session_feed(session, buffer, used_buffer_size);
+	if (session->pending_size > 0)
+	{
+		session_run_line(session);	/* the last line doesn't need a newline */
+	}
+	session_end(session, exclusive);
+
+    return used_buffer_size;
+}
+
+ssize_t hwrw_session_write(struct hwrw_session *session, const char *buffer, size_t count)
+{
+	int exclusive = session_begin(session);
+
+	session_feed(session, buffer, count);
+	session_end(session, exclusive);
+	return count;
+}
+
+size_t hwrw_session_take_output(struct hwrw_session *session, char *buffer, size_t size)
+{
+	mutex_lock(&session->lock);
+	if (size > session->output_size)
+	{
+		size = session->output_size;
+	}
+	memcpy(buffer, session->output, size);
+	memmove(session->output, &session->output[size], session->output_size - size);
+	session->output_size -= size;
+	mutex_unlock(&session->lock);
+
+	return size;
+}
+
+/**
+ * Runs a script that was echoed to /sys/kernel/hwReadWrite/result in the default session
+ * buffer: the message that is being echoed to our kernel, one command per line
+ * count: the size of the message.
+ * return value: the number of bytes handled, at most max_data
+ * */
+ssize_t hwrw_run_script(const char *buffer, size_t count)
+{
+	return hwrw_session_run_script(&hwrw_default_session, buffer, count);
+}
+
+/**
+ * Copies the results of the last script, one "<address> <value>" line per register read
+ * return value: the number of bytes written into buffer
+ * */
+ssize_t hwrw_output_show(char *buffer)
+{
+	struct hwrw_session *session = &hwrw_default_session;
+	ssize_t size;
+
+	mutex_lock(&session->lock);
+	memcpy(buffer, session->output, session->output_size);
+	size = session->output_size;
+	mutex_unlock(&session->lock);
+
+	return size;
+}
+
+/**
+ * Drains as many "<address> <value>" lines from the ring as fit in one page,
+ * preceded by a "lost <n>" line when records were overwritten since the last drain
+ * return value: the number of bytes written into buffer
+ * */
+ssize_t hwrw_ring_drain(char *buffer)
+{
+	const size_t record_length = sizeof("0x00000000 0x00000000\n") - 1;
+	size_t size = 0;
+
+	spin_lock(&ring_lock);
+	if (ring_lost != 0)
+	{
+		size += sprintf(buffer, "lost %u\n", ring_lost);
+		ring_lost = 0;
+	}
+	while (ring_tail != ring_head && size + record_length < PAGE_SIZE)
+	{
+		const struct read_record *record = &ring[ring_tail & (ring_size - 1)];
+
+		size += sprintf(&buffer[size], "0x%08x 0x%08x\n", record->address, record->value);
+		ring_tail++;
+	}
+	spin_unlock(&ring_lock);
+
+	return size;
+}
+
+#define poll_spin_ns	(100 * NSEC_PER_USEC)
+
+/**
+ * Waits until (register & mask) == value, the poll times out after op->timeout_us or at
+ * wait_deadline, whatever comes first. It busy waits for poll_spin_ns, a register that takes
+ * longer is read once per msleep(1) instead of keeping the CPU busy.
+ * return value: 0 when the register matched, -ETIMEDOUT otherwise
+ * */
+static int transaction_poll(struct hwrw_op *op, void __iomem *address, s64 wait_deadline)
+{
+	s64 start = hwrw_now_ns();
+	s64 deadline = min_t(s64, start + (s64)op->timeout_us * NSEC_PER_USEC, wait_deadline);
+	s64 now;
+
+	for (;;)
+	{
+		op->result = hwrw_read(address, op->width);
+		if ((op->result & op->mask) == op->value)
+		{
+			return 0;
+		}
+		now = hwrw_now_ns();
+		if (now >= deadline)
+		{
+			return -ETIMEDOUT;
+		}
+		if (now - start < poll_spin_ns)
+		{
+			udelay(1);
+		}
+		else
+		{
+			msleep(1);
+		}
+	}
+}
+
+/**
+ * Register accesses of the transactions, through the shadow cache
+ * */
+static u32 transaction_read(struct hwrw_op *op, void __iomem *address)
+{
+	u32 value;
+
+	if (!hwrw_shadow_read(op->address, &value, op->width))
+	{
+		value = hwrw_read(address, op->width);
+		hwrw_shadow_fill(op->address, value, op->width);
+	}
+	return value;
+}
+
+static void transaction_write(struct hwrw_op *op, void __iomem *address)
+{
+	if (!hwrw_shadow_write(op->address, op->result, op->width))
+	{
+		hwrw_write(address, op->result, op->width);
+	}
+}
+
+/**
+ * Waits op->timeout_us, sleeping instead of busy waiting from 10 ms on
+ * return value: 0, -EINVAL for a delay that is too long, -ETIMEDOUT when it would end
+ *               after wait_deadline
+ * */
+static int transaction_delay(struct hwrw_op *op, s64 wait_deadline)
+{
+	if (op->timeout_us > HWRW_MAX_TIMEOUT_US)
+	{
+		return -EINVAL;
+	}
+	if (hwrw_now_ns() + (s64)op->timeout_us * NSEC_PER_USEC > wait_deadline)
+	{
+		return -ETIMEDOUT;
+	}
+	if (op->timeout_us >= 10000)
+	{
+		msleep(op->timeout_us / 1000);
+		udelay(op->timeout_us % 1000);
+	}
+	else
+	{
+		udelay(op->timeout_us);
+	}
+	return 0;
+}
+
+/**
+ * Executes one operation of a transaction
+ * wait_deadline: see transaction_wait_deadline
+ * return value: 0 on success, or a negative error code
+ * */
+static int transaction_execute(struct hwrw_session *session, struct hwrw_op *op, s64 wait_deadline)
+{
+	void __iomem *address;
+
+	if (op->op == HWRW_OP_DELAY)
+	{
+		return transaction_delay(op, wait_deadline);
+	}
+	if ((op->width != 1 && op->width != 2 && op->width != 4) || (op->address & (op->width - 1)) != 0)
+	{
+		return -EINVAL;
+	}
+	if (!hwrw_session_allowed(session, op->address, op->width))
+	{
+		return -EPERM;
+	}
+	address = hwrw_translate(op->address);
+
+	switch (op->op)
+	{
+	case HWRW_OP_READ:
+		op->result = transaction_read(op, address);
+		break;
+	case HWRW_OP_WRITE:
+		op->result = op->value;
+		transaction_write(op, address);
+		break;
+	case HWRW_OP_SET_BITS:
+		op->result = transaction_read(op, address) | op->value;
+		transaction_write(op, address);
+		break;
+	case HWRW_OP_CLEAR_BITS:
+		op->result = transaction_read(op, address) & ~op->value;
+		transaction_write(op, address);
+		break;
+	case HWRW_OP_MASKED_WRITE:
+		op->result = (transaction_read(op, address) & ~op->mask) | (op->value & op->mask);
+		transaction_write(op, address);
+		break;
+	case HWRW_OP_POLL:
+		if (op->timeout_us > HWRW_MAX_TIMEOUT_US)
+		{
+			return -EINVAL;
+		}
+		return transaction_poll(op, address, wait_deadline);
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int hwrw_session_transaction(struct hwrw_session *session, struct hwrw_op *ops, u32 count, u32 *completed)
+{
+	int result = 0;
+	int exclusive;
+	s64 wait_deadline;
+	u32 i;
+
+	exclusive = session_begin(session);
+	wait_deadline = transaction_wait_deadline();
+	for (i = 0; i < count; i++)
+	{
+		result = transaction_execute(session, &ops[i], wait_deadline);
+		if (result != 0)
+		{
+			break;
+		}
+	}
+	session->stats.transactions++;
+	session->stats.transaction_ops += i;
+	session_end(session, exclusive);
+
+	*completed = i;
+	hwrw_stats_add(&hwrw_stats.transactions, 1);
+	hwrw_stats_add(&hwrw_stats.transaction_ops, i);
+	return result;
+}
+
+int hwrw_transaction_run(struct hwrw_op *ops, u32 count, u32 *completed)
+{
+	return hwrw_session_transaction(&hwrw_default_session, ops, count, completed);
+}
+
+struct diff_records
+{
+	struct hwrw_diff_record *records;
+	u32 max_records;
+	u32 count;
+};
+
+static int diff_record(void *context, u32 address, u32 old_value, u32 new_value)
+{
+	struct diff_records *diff = context;
+
+	if (diff->count == diff->max_records)
+	{
+		return 0;
+	}
+	diff->records[diff->count].address = address;
+	diff->records[diff->count].old_value = old_value;
+	diff->records[diff->count].new_value = new_value;
+	diff->count++;
+	return 1;
+}
+
+int hwrw_session_diff(struct hwrw_session *session, const char *name, struct hwrw_diff_record *records, u32 max_records, u32 *count)
+{
+	struct diff_records diff = { records, max_records, 0 };
+	struct hwrw_snapshot *snapshot;
+	int result;
+	int exclusive;
+
+	exclusive = session_begin(session);
+	result = snapshot_lookup(session, name, &snapshot);
+	if (result == 0)
+	{
+		result = snapshot_diff(session, snapshot, diff_record, &diff);
+	}
+	session_end(session, exclusive);
+
+	*count = diff.count;
+	return result;
+}
+
+/**
+ * Burst capture, see hwrw_ioctl.h
+ * The loop only reads and compares while the register doesn't change, the encoding costs are
+ * paid per transition. The clock is read every capture_check_samples samples, so a chunk
+ * with interrupts off can run that many samples longer than HWRW_CAPTURE_CHUNK_US.
+ * */
+#define capture_check_samples	1024
+#define capture_max_record	11	/* a gap: three LEB128 encoded u32, the last one is 0 */
+
+static u32 capture_put(u8 *buffer, u32 used, u32 value)
+{
+	do
+	{
+		u8 byte = value & 0x7f;
+
+		value >>= 7;
+		buffer[used++] = value != 0 ? byte | 0x80 : byte;
+	}
+	while (value != 0);
+	return used;
+}
+
+int hwrw_session_capture(struct hwrw_session *session, struct hwrw_capture *capture, u8 *buffer)
+{
+	void __iomem *address;
+	unsigned long flags;
+	u32 mask = capture->mask;
+	u32 previous;
+	u32 last_transition = 0;
+	u32 used = 0;
+	u32 transitions = 0;
+	u32 i;
+	s64 start;
+	s64 deadline;
+	s64 chunk_end;
+	s64 gap_ns = 0;
+	int exclusive;
+
+	if ((capture->address & (register_size - 1)) != 0 || capture->samples == 0 ||
+	    capture->samples > HWRW_CAPTURE_MAX_SAMPLES || capture->size > HWRW_CAPTURE_MAX_BYTES)
+	{
+		return -EINVAL;
+	}
+
+	exclusive = session_begin(session);
+	if (!hwrw_session_allowed(session, capture->address, register_size))
+	{
+		session_end(session, exclusive);
+		return -EPERM;
+	}
+	address = hwrw_translate(capture->address);
+
+	local_irq_save(flags);
+	start = hwrw_now_ns();
+	deadline = start + (s64)HWRW_CAPTURE_MAX_US * NSEC_PER_USEC;
+	chunk_end = start + (s64)HWRW_CAPTURE_CHUNK_US * NSEC_PER_USEC;
+	previous = hwrw_read(address, register_size) & mask;
+	capture->first_value = previous;
+
+	for (i = 1; i < capture->samples; i++)
+	{
+		u32 value = hwrw_read(address, register_size) & mask;
+
+		if (unlikely(value != previous))
+		{
+			if (capture->size - used < capture_max_record)
+			{
+				break;
+			}
+			used = capture_put(buffer, used, i - last_transition);
+			used = capture_put(buffer, used, value ^ previous);
+			last_transition = i;
+			previous = value;
+			transitions++;
+		}
+		if (unlikely((i & (capture_check_samples - 1)) == 0))
+		{
+			s64 now = hwrw_now_ns();
+			s64 gap;
+
+			if (now >= deadline || (now >= chunk_end && capture->size - used < capture_max_record))
+			{
+				i++;
+				break;
+			}
+			if (now >= chunk_end)
+			{
+				/* let in the interrupts that came during the chunk, sample i + 1 is the next */
+				local_irq_restore(flags);
+				cond_resched();
+				local_irq_save(flags);
+				chunk_end = hwrw_now_ns();
+				gap = chunk_end - now;
+				chunk_end += (s64)HWRW_CAPTURE_CHUNK_US * NSEC_PER_USEC;
+
+				used = capture_put(buffer, used, i + 1 - last_transition);
+				used = capture_put(buffer, used, 0);
+				used = capture_put(buffer, used, min_t(s64, gap, 0xffffffff));
+				last_transition = i + 1;
+				gap_ns += gap;
+			}
+		}
+	}
+	capture->elapsed_ns = hwrw_now_ns() - start;
+	local_irq_restore(flags);
+	capture->gap_ns = gap_ns;
+
+	capture->used = used;
+	capture->taken = i;
+	capture->transitions = transitions;
+	session->stats.registers_read += i;
+	session_end(session, exclusive);
+
+	hwrw_stats_add(&hwrw_stats.registers_read, i);
+	hwrw_stats_add(&hwrw_stats.bytes_read, (u64)i * register_size);
+	es6_trace_debug("capture", "address=0x%08x taken=%u transitions=%u bytes=%u ns=%lld",
+		capture->address, i, transitions, used, (long long)capture->elapsed_ns);
+	return 0;
+}
+
+/**
+ * Stored programs, see hwrw_ioctl.h
+ * A program is compiled once into an array of transaction operations that is checked up
+ * front: only the window of the session that runs it is left to check. Handles are indexes
+ * in programs. Runs hold program_lock for reading, so a program can't be freed under them.
+ * */
+struct hwrw_program
+{
+	char name[HWRW_PROGRAM_NAME];
+	u32 count;
+	struct hwrw_op ops[0];
+};
+
+static struct hwrw_program *programs[HWRW_MAX_PROGRAMS];
+static DECLARE_RWSEM(program_lock);
+
+/**
+ * Parses one number of a program line, at least one digit after spaces and tabs
+ * return value: the first character after the number, or NULL when there is no number
+ * */
+static const char *program_number(const char *text, unsigned int base, u32 *value)
+{
+	char *end;
+
+	while (*text == ' ' || *text == '\t')
+	{
+		text++;
+	}
+	*value = simple_strtoul(text, &end, base);
+	return end != text ? end : NULL;
+}
+
+/**
+ * Compiles one '\0' terminated line into ops
+ * return value: the number of operations, 0 for an empty line or a comment, -EINVAL on a syntax error
+ * */
+static int program_line(const char *line, struct hwrw_op *ops, u32 room)
+{
+	u32 values[4];
+	u32 fields;
+	u32 i;
+	char command;
+	struct hwrw_op op = { .width = register_size };
+
+	while (*line == ' ' || *line == '\t')
+	{
+		line++;
+	}
+	command = *line++;
+	switch (command)
+	{
+	case '\0':
+	case '#':
+		return 0;
+	case 'r':
+	case 'w':
+	case 's':
+	case 'c':
+		fields = 2;
+		break;
+	case 'm':
+		fields = 3;
+		break;
+	case 'p':
+		fields = 4;
+		break;
+	case 'd':
+		fields = 1;
+		break;
+	default:
+		return -EINVAL;
+	}
+	for (i = 0; i < fields; i++)
+	{
+		/* amounts and times are decimal */
+		int decimal = (command == 'r' && i == 0) || command == 'd' || (command == 'p' && i == 3);
+
+		if (*line != ' ' && *line != '\t')
+		{
+			return -EINVAL;
+		}
+		line = program_number(line, decimal ? 10 : 16, &values[i]);
+		if (line == NULL)
+		{
+			return -EINVAL;
+		}
+	}
+	while (*line == ' ' || *line == '\t')
+	{
+		line++;
+	}
+	if (*line != '\0')
+	{
+		return -EINVAL;
+	}
+
+	switch (command)
+	{
+	case 'd':
+		op.op = HWRW_OP_DELAY;
+		op.timeout_us = values[0];
+		if (op.timeout_us > HWRW_MAX_TIMEOUT_US || room == 0)
+		{
+			return -EINVAL;
+		}
+		ops[0] = op;
+		return 1;
+	case 'r':
+		/* one operation per register, they are read at a register_size stride */
+		if (values[0] == 0 || values[0] > room || (values[1] & (register_size - 1)) != 0 ||
+		    values[1] + (values[0] * register_size - 1) < values[1])
+		{
+			return -EINVAL;
+		}
+		op.op = HWRW_OP_READ;
+		for (i = 0; i < values[0]; i++)
+		{
+			op.address = values[1] + i * register_size;
+			ops[i] = op;
+		}
+		return values[0];
+	case 'w':
+		op.op = HWRW_OP_WRITE;
+		break;
+	case 's':
+		op.op = HWRW_OP_SET_BITS;
+		break;
+	case 'c':
+		op.op = HWRW_OP_CLEAR_BITS;
+		break;
+	case 'm':
+		op.op = HWRW_OP_MASKED_WRITE;
+		op.mask = values[1];
+		break;
+	case 'p':
+		op.op = HWRW_OP_POLL;
+		op.mask = values[1];
+		op.timeout_us = values[3];
+		break;
+	}
+	op.address = values[0];
+	op.value = values[fields == 2 ? 1 : 2];
+	if ((op.address & (register_size - 1)) != 0 || op.timeout_us > HWRW_MAX_TIMEOUT_US || room == 0)
+	{
+		return -EINVAL;
+	}
+	ops[0] = op;
+	return 1;
+}
+
+int hwrw_program_load(const char *name, const char *text, size_t size, u32 *error_line)
+{
+	struct hwrw_op *ops;
+	struct hwrw_program *program = NULL;
+	char line[max_line + 1];
+	const char *line_start = text;
+	const char *text_end = text + size;
+	u32 count = 0;
+	int handle = 0;
+	int result;
+
+	*error_line = 0;
+	if (name[0] == '\0' || size > HWRW_PROGRAM_MAX_TEXT)
+	{
+		return -EINVAL;
+	}
+	/* compiled at the largest size first, the program gets an allocation of its exact size */
+	ops = vmalloc(HWRW_PROGRAM_MAX_OPS * sizeof(*ops));
+	if (ops == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	while (line_start < text_end)
+	{
+		const char *line_end = memchr(line_start, '\n', text_end - line_start);
+		size_t line_length = (line_end != NULL ? line_end : text_end) - line_start;
+
+		(*error_line)++;
+		if (line_length > max_line)
+		{
+			handle = -EINVAL;
+			goto out;
+		}
+		memcpy(line, line_start, line_length);
+		line[line_length] = '\0';
+		result = program_line(line, &ops[count], HWRW_PROGRAM_MAX_OPS - count);
+		if (result < 0)
+		{
+			handle = result;
+			goto out;
+		}
+		count += result;
+		line_start = line_end != NULL ? line_end + 1 : text_end;
+	}
+	*error_line = 0;
+	if (count == 0)
+	{
+		handle = -EINVAL;
+		goto out;
+	}
+
+	program = kmalloc(sizeof(*program) + count * sizeof(*ops), GFP_KERNEL);
+	if (program == NULL)
+	{
+		handle = -ENOMEM;
+		goto out;
+	}
+	strncpy(program->name, name, sizeof(program->name) - 1);
+	program->name[sizeof(program->name) - 1] = '\0';
+	program->count = count;
+	memcpy(program->ops, ops, count * sizeof(*ops));
+
+	down_write(&program_lock);
+	for (handle = 0; handle < HWRW_MAX_PROGRAMS; handle++)
+	{
+		if (programs[handle] != NULL && strcmp(programs[handle]->name, program->name) == 0)
+		{
+			handle = -EEXIST;
+			break;
+		}
+	}
+	if (handle == HWRW_MAX_PROGRAMS)
+	{
+		for (handle = 0; handle < HWRW_MAX_PROGRAMS && programs[handle] != NULL; handle++)
+		{
+		}
+		if (handle < HWRW_MAX_PROGRAMS)
+		{
+			programs[handle] = program;
+			program = NULL;
+		}
+		else
+		{
+			handle = -ENOSPC;
+		}
+	}
+	up_write(&program_lock);
+	es6_trace_info("program_load", "name=%s operations=%u handle=%d", name, count, handle);
+
+out:
+	kfree(program);
+	vfree(ops);
+	return handle;
+}
+
+int hwrw_program_free(u32 handle)
+{
+	struct hwrw_program *program = NULL;
+
+	down_write(&program_lock);
+	if (handle < HWRW_MAX_PROGRAMS)
+	{
+		program = programs[handle];
+		programs[handle] = NULL;
+	}
+	up_write(&program_lock);
+
+	if (program == NULL)
+	{
+		return -ENOENT;
+	}
+	es6_trace_info("program_free", "name=%s handle=%u", program->name, handle);
+	kfree(program);
+	return 0;
+}
+
+/**
+ * Handles the execute function, "x <handle>"
+ * The operations are run on a copy, the program itself is never changed by a run. Its polls
+ * and delays share the wait deadline of the script, see session_feed.
+ * buffer: the incoming message to be handled
+ * return value: 0, -EINVAL when it is not according to the protocol, -ENOENT when there is no
+ *               such program, or the error of the first operation that failed
+ * */
+static int handle_execute(struct hwrw_session *session, const char *buffer)
+{
+	struct hwrw_program *program;
+	u32 handle;
+	u32 reads = 0;
+	u32 i;
+	int result = 0;
+
+	if (program_number(buffer, 10, &handle) == NULL)
+	{
+		return -EINVAL;
+	}
+
+	down_read(&program_lock);
+	program = handle < HWRW_MAX_PROGRAMS ? programs[handle] : NULL;
+	if (program == NULL)
+	{
+		result = -ENOENT;
+	}
+	for (i = 0; program != NULL && i < program->count; i++)
+	{
+		struct hwrw_op op = program->ops[i];
+
+		result = transaction_execute(session, &op, session->wait_deadline);
+		if (result != 0)
+		{
+			break;
+		}
+		if (op.op == HWRW_OP_READ)
+		{
+			ring_push(op.address, op.result);
+			output_append(session, "0x%08x 0x%08x\n", op.address, op.result);
+			reads++;
+		}
+	}
+	up_read(&program_lock);
+
+	snapshot_count_reads(session, reads);
+	session->stats.transaction_ops += i;
+	hwrw_stats_add(&hwrw_stats.transaction_ops, i);
+	es6_trace_debug("execute", "handle=%u operations=%u result=%d", handle, i, result);
+	return result;
+}
+
+ssize_t hwrw_programs_show(char *buffer)
+{
+	size_t size = 0;
+	int handle;
+
+	down_read(&program_lock);
+	for (handle = 0; handle < HWRW_MAX_PROGRAMS; handle++)
+	{
+		if (programs[handle] != NULL)
+		{
+			size += scnprintf(&buffer[size], PAGE_SIZE - size, "%d %s %u\n",
+				handle, programs[handle]->name, programs[handle]->count);
+		}
+	}
+	up_read(&program_lock);
+	return size;
+}
+
+void hwrw_programs_exit(void)
+{
+	u32 handle;
+
+	for (handle = 0; handle < HWRW_MAX_PROGRAMS; handle++)
+	{
+		hwrw_program_free(handle);
+	}
+}
@@ -0,0 +1,404 @@
+/**
+ * ioctl interface of /dev/hwrw, shared between the hwReadWrite module and userspace
+ * */
+#ifndef HWRW_IOCTL_H
+#define HWRW_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/**
+ * Operations of a transaction
+ * HWRW_OP_READ:        result = *address
+ * HWRW_OP_WRITE:       *address = value
+ * HWRW_OP_SET_BITS:    *address |= value, result is the value written
+ * HWRW_OP_CLEAR_BITS:  *address &= ~value, result is the value written
+ * HWRW_OP_MASKED_WRITE: *address = (*address & ~mask) | (value & mask), result is the value written
+ * HWRW_OP_POLL:        wait until (*address & mask) == value or timeout_us passed, result is the last value read
+ * HWRW_OP_DELAY:       wait timeout_us, address and width are not used, see HWRW_MAX_TIMEOUT_US
+ * */
+#define HWRW_OP_READ		0
+#define HWRW_OP_WRITE		1
+#define HWRW_OP_SET_BITS	2
+#define HWRW_OP_CLEAR_BITS	3
+#define HWRW_OP_MASKED_WRITE	4
+#define HWRW_OP_POLL		5
+#define HWRW_OP_DELAY		6
+
+/**
+ * One register operation, width is the access size in bytes (1, 2 or 4)
+ * and address must be aligned to it
+ * */
+struct hwrw_op
+{
+	__u32 address;
+	__u32 value;
+	__u32 mask;
+	__u32 result;
+	__u32 timeout_us;
+	__u8 op;
+	__u8 width;
+	__u16 reserved;
+};
+
+/**
+ * A transaction runs count operations in order in one kernel entry. No other
+ * user of the module touches the same registers while it runs, so read-modify-write
+ * operations are atomic with respect to scripts and other transactions.
+ * ops: pointer to an array of count struct hwrw_op, results are written back to it
+ * completed: set by the kernel to the number of operations that were executed
+ * */
+struct hwrw_transaction
+{
+	__u64 ops;
+	__u32 count;
+	__u32 completed;
+};
+
+#define HWRW_MAX_OPS		256
+/**
+ * The longest poll or delay, and also the longest all polls and delays of one transaction
+ * may wait together: a poll that is still waiting when the transaction has run this long
+ * times out, a delay that would end after that fails with -ETIMEDOUT without waiting
+ * */
+#define HWRW_MAX_TIMEOUT_US	1000000
+
+/**
+ * Periodic sampler of /dev/hwrw_sampler: every period_ns an hrtimer reads count
+ * 32-bit registers into a ring of ring_entries records (a power of two).
+ * Readers of /dev/hwrw_sampler are woken when wakeup_threshold records are queued.
+ * */
+#define HWRW_SAMPLER_MAX_REGS		16
+#define HWRW_SAMPLER_MIN_PERIOD_NS	50000
+#define HWRW_SAMPLER_MAX_ENTRIES	65536
+
+struct hwrw_sampler_config
+{
+	__u32 period_ns;
+	__u32 count;
+	__u32 ring_entries;
+	__u32 wakeup_threshold;
+	__u32 addresses[HWRW_SAMPLER_MAX_REGS];
+};
+
+/**
+ * One record as returned by read() on /dev/hwrw_sampler
+ * sequence: number of the timer period this sample was taken in, gaps mean dropped samples
+ * missed: total number of timer periods the sampler was too late for so far
+ * */
+struct hwrw_sample
+{
+	__u64 timestamp_ns;
+	__u32 sequence;
+	__u32 missed;
+	__u32 values[HWRW_SAMPLER_MAX_REGS];
+};
+
+struct hwrw_sampler_stats
+{
+	__u32 samples;
+	__u32 dropped;
+	__u32 missed;
+	__u32 queued;
+};
+
+/**
+ * Every open of /dev/hwrw is a session with its own script parser, output, counters and
+ * address window. Scripts written to the device are executed line by line, a line may be
+ * split over several writes. Errors are reported as "error <line>" in the output, where
+ * lines are counted from the open.
+ * HWRW_IOC_SET_WINDOW: limits pread, mmap, scripts and transactions of the session to
+ *   [base, base + size). Windows of different sessions can't overlap (-EBUSY), and
+ *   sessions with a window run in parallel. size 0 removes the window again: the session
+ *   may access every register, and runs one at a time with the other sessions without a
+ *   window, like the sysfs files do.
+ * HWRW_IOC_OUTPUT: copies at most size bytes of output into data, removes them from the
+ *   session and sets used to the number of bytes copied. The output is one page, lines
+ *   that don't fit anymore are dropped until it is read.
+ * HWRW_IOC_SESSION_STATS: the counters of this session, always enabled.
+ * */
+struct hwrw_window
+{
+	__u32 base;
+	__u32 size;
+};
+
+struct hwrw_output
+{
+	__u64 data;
+	__u32 size;
+	__u32 used;
+};
+
+struct hwrw_session_stats
+{
+	__u64 scripts;
+	__u64 commands;
+	__u64 errors;
+	__u64 registers_read;
+	__u64 registers_written;
+	__u64 bytes_read;
+	__u64 transactions;
+	__u64 transaction_ops;
+	__u64 denied;
+};
+
+/**
+ * Snapshots of register ranges, per session. The script command
+ * "c <name> <amount of registers> <start address>" stores the current values of a range
+ * under a name, "c <name> 0" removes the snapshot again. "d <name>" reads the range again
+ * and outputs one "<address> <old value> <new value>" line per register that changed.
+ * HWRW_IOC_SNAPSHOT_DIFF does the same, but stores at most max_records binary records in
+ * records and sets count to the number stored and changed to the number of registers
+ * that changed. Both take the new values into the snapshot for the registers they report,
+ * so every change is reported once, by the first diff that has room for it.
+ * */
+#define HWRW_SNAPSHOT_NAME		16
+#define HWRW_SNAPSHOT_MAX_REGS		16384
+#define HWRW_MAX_SNAPSHOTS		8
+#define HWRW_MAX_DIFF_RECORDS		4096
+
+struct hwrw_diff_record
+{
+	__u32 address;
+	__u32 old_value;
+	__u32 new_value;
+};
+
+struct hwrw_diff
+{
+	char name[HWRW_SNAPSHOT_NAME];
+	__u64 records;
+	__u32 max_records;
+	__u32 count;
+	__u32 changed;
+	__u32 reserved;
+};
+
+/**
+ * Watches wait in the kernel until a register reaches a value, instead of a script that reads
+ * it over and over. HWRW_IOC_WATCH arms the watch of a session: the register is read right away
+ * and then from a timer until (register & mask) == value or timeout_us passed. While the
+ * condition doesn't hold the timer backs off, from HWRW_WATCH_MIN_INTERVAL_NS doubling up to
+ * interval_us, so short waits react within microseconds and long waits cost little.
+ * When the watch is finished poll() on /dev/hwrw reports POLLPRI, and HWRW_IOC_WATCH_WAIT
+ * returns the result and disarms the watch. HWRW_IOC_WATCH_WAIT blocks until then, or fails
+ * with -EAGAIN on a non-blocking file. A session has one watch at a time (-EBUSY while it is
+ * armed), closing the file cancels it.
+ * value: the last value read
+ * result: 0 when the condition held, -ETIMEDOUT when the timeout passed
+ * polls: the number of times the register was read
+ * */
+#define HWRW_WATCH_MIN_INTERVAL_NS	2000
+#define HWRW_WATCH_MAX_TIMEOUT_US	60000000
+
+struct hwrw_watch
+{
+	__u32 address;
+	__u32 mask;
+	__u32 value;
+	__u32 timeout_us;
+	__u32 interval_us;
+	__u32 reserved;
+};
+
+struct hwrw_watch_result
+{
+	__u32 value;
+	__s32 result;
+	__u32 polls;
+	__u32 reserved;
+	__u64 elapsed_ns;
+};
+
+/**
+ * The waveform player writes registers at precise times from a high resolution timer.
+ * A waveform is a list of steps: wait delay_ns after the previous step, then write value
+ * to the 32-bit register at address. Steps with delay_ns 0 are written together with the
+ * previous one. There is one player for all users of the module. It may only be loaded,
+ * started and stopped by the session that loaded the last waveform, or by a session whose
+ * window covers every loaded waveform, others get -EPERM.
+ * HWRW_IOC_WAVE_LOAD: uploads a waveform of count steps. When the player is stopped it
+ *   replaces the loaded waveform. While it plays, the new waveform is queued and takes over
+ *   at the end of the current pass, so the output continues without a gap. A waveform with
+ *   HWRW_WAVE_LOOP is repeated until it is stopped or replaced, it must take at least
+ *   HWRW_WAVE_MIN_LOOP_NS per pass.
+ * HWRW_IOC_WAVE_START plays the loaded waveform from its first step, HWRW_IOC_WAVE_STOP
+ *   stops it. A waveform without HWRW_WAVE_LOOP stops by itself after one pass.
+ * HWRW_IOC_WAVE_STATUS: steps were written late when the timer fired more than
+ *   HWRW_WAVE_LATE_NS after their time, max_late_ns is the worst case.
+ * */
+#define HWRW_WAVE_MAX_STEPS	4096
+#define HWRW_WAVE_MIN_LOOP_NS	10000
+#define HWRW_WAVE_LATE_NS	20000
+#define HWRW_WAVE_LOOP		1
+
+struct hwrw_wave_step
+{
+	__u32 delay_ns;
+	__u32 address;
+	__u32 value;
+};
+
+struct hwrw_wave
+{
+	__u64 steps;
+	__u32 count;
+	__u32 flags;
+};
+
+struct hwrw_wave_status
+{
+	__u64 steps;
+	__u32 passes;
+	__u32 late;
+	__u32 max_late_ns;
+	__u32 playing;
+	__u32 queued;
+	__u32 reserved;
+};
+
+/**
+ * HWRW_IOC_CAPTURE samples one register as fast as the bus allows, like a logic analyzer.
+ * The burst is limited to HWRW_CAPTURE_MAX_US. Interrupts are off while it samples, but at
+ * most about HWRW_CAPTURE_CHUNK_US at a time: then they are let in, and sampling goes on
+ * after that gap. Only the bits in mask are compared, and only transitions and gaps are
+ * stored, as a stream of unsigned LEB128 numbers (7 bits per byte, least significant first,
+ * 0x80 = more bytes). A transition is a pair:
+ *   run   the number of samples since the previous record (or since sample 0)
+ *   bits  the new value XOR the previous value, never 0
+ * A gap is a pair with bits 0, followed by the length of the gap in ns. Its run ends at the
+ * first sample after the gap, a transition during the gap follows it with run 0.
+ * The value of sample 0 is first_value. The capture stops after samples samples, when the
+ * time is up, or when the next record doesn't fit in size bytes anymore. Timestamps are
+ * sample numbers, (elapsed_ns - gap_ns) / taken is the time between two samples.
+ * */
+#define HWRW_CAPTURE_MAX_SAMPLES	(1 << 26)
+#define HWRW_CAPTURE_MAX_BYTES		(1 << 20)
+#define HWRW_CAPTURE_MAX_US		200000
+#define HWRW_CAPTURE_CHUNK_US		1000
+
+struct hwrw_capture
+{
+	__u64 data;
+	__u32 size;
+	__u32 address;
+	__u32 mask;
+	__u32 samples;
+	__u32 used;		/* set by the kernel: bytes of the stream in data */
+	__u32 taken;		/* set by the kernel: samples taken */
+	__u32 transitions;	/* set by the kernel */
+	__u32 first_value;	/* set by the kernel */
+	__u64 elapsed_ns;	/* set by the kernel */
+	__u64 gap_ns;		/* set by the kernel: time spent in gaps */
+};
+
+/**
+ * /dev/hwrw_ring queues register operations through memory shared with a kernel worker,
+ * so a stream of operations needs no system call per operation. Every open is a session,
+ * HWRW_IOC_SET_WINDOW works on it as on /dev/hwrw.
+ * HWRW_IOC_RING_SETUP creates a submission ring and a completion ring of entries entries
+ * (a power of two) and starts the worker. mmap offset 0 then maps HWRW_RING_SIZE(entries)
+ * bytes: a struct hwrw_ring_header at HWRW_RING_HEADER_OFFSET, the submission entries at
+ * HWRW_RING_SQ_OFFSET and the completion entries at HWRW_RING_CQ_OFFSET(entries).
+ * The indices run freely, entry i lives at index i & (entries - 1).
+ *   submit:   fill sq[sq_tail], then (write barrier) sq_tail++
+ *   complete: while cq_head != cq_tail (read barrier): use cq[cq_head], then cq_head++
+ * The worker executes the operations in order, like transactions of HWRW_IOC_TRANSACTION,
+ * and only takes a submission when there is room for its completion. When it has had
+ * nothing to do for a while it sets HWRW_RING_IDLE and sleeps: after updating sq_tail,
+ * userspace issues a full barrier, and when HWRW_RING_IDLE is set it rings the doorbell,
+ * HWRW_IOC_RING_ENTER. poll() reports POLLIN while completions are waiting.
+ * */
+#define HWRW_RING_MAX_ENTRIES	4096
+#define HWRW_RING_IDLE		1
+
+struct hwrw_ring_header
+{
+	__u32 sq_head;		/* written by the kernel */
+	__u32 sq_tail;		/* written by userspace */
+	__u32 cq_head;		/* written by userspace */
+	__u32 cq_tail;		/* written by the kernel */
+	__u32 entries;
+	__u32 flags;		/* written by the kernel */
+	__u32 reserved[10];
+};
+
+struct hwrw_sqe
+{
+	struct hwrw_op op;
+	__u64 user_data;
+};
+
+/**
+ * result: the result of the operation, error: 0 or the negative error code of the operation
+ * */
+struct hwrw_cqe
+{
+	__u64 user_data;
+	__u32 result;
+	__s32 error;
+};
+
+#define HWRW_RING_HEADER_OFFSET		0
+#define HWRW_RING_SQ_OFFSET		sizeof(struct hwrw_ring_header)
+#define HWRW_RING_CQ_OFFSET(entries)	(HWRW_RING_SQ_OFFSET + (entries) * sizeof(struct hwrw_sqe))
+#define HWRW_RING_SIZE(entries)		(HWRW_RING_CQ_OFFSET(entries) + (entries) * sizeof(struct hwrw_cqe))
+
+/**
+ * Stored programs are register sequences that are parsed once and then run by handle, by
+ * any user of the module. HWRW_IOC_PROGRAM_LOAD compiles size bytes of text, one operation
+ * per line, into 32-bit transaction operations:
+ *   r <amount of registers> <address>            HWRW_OP_READ of consecutive registers, 4 bytes
+ *                                                apart (the script command "r" steps 1 byte)
+ *   w <address> <value>                          HWRW_OP_WRITE
+ *   s <address> <bits>                           HWRW_OP_SET_BITS
+ *   c <address> <bits>                           HWRW_OP_CLEAR_BITS
+ *   m <address> <mask> <value>                   HWRW_OP_MASKED_WRITE
+ *   p <address> <mask> <value> <timeout in us>   HWRW_OP_POLL
+ *   d <time in us>                               HWRW_OP_DELAY
+ * Numbers are hexadecimal, except amounts and times. Empty lines and lines starting with
+ * '#' are skipped. On success handle is set, on a syntax error error_line is the line.
+ * The script command "x <handle>" runs a program: the registers it reads are output like
+ * those of "r", and it stops at the first operation that fails. HWRW_IOC_PROGRAM_FREE
+ * removes the program with the handle passed as argument.
+ * /sys/kernel/hwReadWrite/programs lists "<handle> <name> <operations>".
+ * */
+#define HWRW_MAX_PROGRAMS		32
+#define HWRW_PROGRAM_MAX_OPS		1024
+#define HWRW_PROGRAM_MAX_TEXT		65536
+#define HWRW_PROGRAM_NAME		16
+
+struct hwrw_program_load
+{
+	__u64 text;
+	__u32 size;
+	__s32 handle;		/* set by the kernel */
+	__u32 error_line;	/* set by the kernel */
+	__u32 reserved;
+	char name[HWRW_PROGRAM_NAME];
+};
+
+#define HWRW_IOC_MAGIC		'h'
+#define HWRW_IOC_TRANSACTION	_IOWR(HWRW_IOC_MAGIC, 1, struct hwrw_transaction)
+#define HWRW_IOC_SAMPLER_CONFIG	_IOW(HWRW_IOC_MAGIC, 2, struct hwrw_sampler_config)
+#define HWRW_IOC_SAMPLER_START	_IO(HWRW_IOC_MAGIC, 3)
+#define HWRW_IOC_SAMPLER_STOP	_IO(HWRW_IOC_MAGIC, 4)
+#define HWRW_IOC_SAMPLER_STATS	_IOR(HWRW_IOC_MAGIC, 5, struct hwrw_sampler_stats)
+#define HWRW_IOC_SET_WINDOW	_IOW(HWRW_IOC_MAGIC, 6, struct hwrw_window)
+#define HWRW_IOC_OUTPUT		_IOWR(HWRW_IOC_MAGIC, 7, struct hwrw_output)
+#define HWRW_IOC_SESSION_STATS	_IOR(HWRW_IOC_MAGIC, 8, struct hwrw_session_stats)
+#define HWRW_IOC_SNAPSHOT_DIFF	_IOWR(HWRW_IOC_MAGIC, 9, struct hwrw_diff)
+#define HWRW_IOC_WATCH		_IOW(HWRW_IOC_MAGIC, 10, struct hwrw_watch)
+#define HWRW_IOC_WATCH_WAIT	_IOR(HWRW_IOC_MAGIC, 11, struct hwrw_watch_result)
+#define HWRW_IOC_WAVE_LOAD	_IOW(HWRW_IOC_MAGIC, 12, struct hwrw_wave)
+#define HWRW_IOC_WAVE_START	_IO(HWRW_IOC_MAGIC, 13)
+#define HWRW_IOC_WAVE_STOP	_IO(HWRW_IOC_MAGIC, 14)
+#define HWRW_IOC_WAVE_STATUS	_IOR(HWRW_IOC_MAGIC, 15, struct hwrw_wave_status)
+#define HWRW_IOC_CAPTURE	_IOWR(HWRW_IOC_MAGIC, 16, struct hwrw_capture)
+#define HWRW_IOC_RING_SETUP	_IO(HWRW_IOC_MAGIC, 17)
+#define HWRW_IOC_RING_ENTER	_IO(HWRW_IOC_MAGIC, 18)
+#define HWRW_IOC_PROGRAM_LOAD	_IOWR(HWRW_IOC_MAGIC, 19, struct hwrw_program_load)
+#define HWRW_IOC_PROGRAM_FREE	_IO(HWRW_IOC_MAGIC, 20)
+
+#endif
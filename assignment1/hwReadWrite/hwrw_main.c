@@ -0,0 +1,1625 @@
+/**
+ * Includes from the linux/kernel libraries 
+ * */
+#include <linux/kernel.h>    
+#include <linux/module.h>    
+#include <linux/kobject.h>   
+#include <linux/device.h>
+#include <linux/io.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/unistd.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+
+#include "hwReadWrite.h"
+
+/**
+ * Defines for our kernel attributes
+ * */
+#define kernel_dir	"hwReadWrite"
+#define	kernel_file	"result"
+#define	output_file	"output"
+#define	ring_file	"ring"
+
+/**
+ * Defines for our character device /dev/hwrw
+ * */
+#define device_name "hwrw"
+#define device_chunk_registers 64
+#define sampler_device_name "hwrw_sampler"
+
+/**
+ * This method is called when the user calls echo on our kernel module
+ * *dev and *attr: not yet required for our functionality
+ * buffer: the message that is being echoed to our kernel, one command per line
+ * size: the size of the message.
+ * return value: if return != count, then sysfs will call echo with the remainder of the message. (should not be >1024 bytes)
+ * */
+static ssize_t sysfs_store(struct device *dev, struct device_attribute *attr, const char *buffer, size_t count)
+{
+	return hwrw_run_script(buffer, count);
+}
+
+/**
+ * This method is called when the user calls cat on /sys/kernel/hwReadWrite/output
+ * buffer: receives the results of the last script, one "<address> <value>" line per register read
+ * return value: the number of bytes written into buffer
+ * */
+static ssize_t sysfs_show_output(struct device *dev, struct device_attribute *attr, char *buffer)
+{
+	return hwrw_output_show(buffer);
+}
+
+/**
+ * This method is called when the user calls cat on /sys/kernel/hwReadWrite/ring
+ * buffer: receives as many "<address> <value>" lines from the ring as fit in one page,
+ *         preceded by a "lost <n>" line when records were overwritten since the last read
+ * return value: the number of bytes written into buffer
+ * */
+static ssize_t sysfs_show_ring(struct device *dev, struct device_attribute *attr, char *buffer)
+{
+	return hwrw_ring_drain(buffer);
+}
+
+/**
+ * This method is called when the user calls cat on /sys/kernel/hwReadWrite/stats
+ * buffer: receives one "<counter> <value>" line per counter, followed by one line per phase:
+ *         "<phase> <count> <total ns> <bucket 0> ... <bucket 31>"
+ * return value: the number of bytes written into buffer
+ * */
+static ssize_t sysfs_show_stats(struct device *dev, struct device_attribute *attr, char *buffer)
+{
+	return hwrw_stats_show(buffer);
+}
+
+/**
+ * cat /sys/kernel/hwReadWrite/stats_enable shows whether instrumentation is on
+ * */
+static ssize_t sysfs_show_stats_enable(struct device *dev, struct device_attribute *attr, char *buffer)
+{
+	return sprintf(buffer, "%d\n", hwrw_stats_enabled);
+}
+
+/**
+ * echo 1 > /sys/kernel/hwReadWrite/stats_enable turns instrumentation on, echo 0 turns it off
+ * */
+static ssize_t sysfs_store_stats_enable(struct device *dev, struct device_attribute *attr, const char *buffer, size_t count)
+{
+	hwrw_stats_enabled = simple_strtol(buffer, NULL, 10) != 0;
+	return count;
+}
+
+/**
+ * Any write to /sys/kernel/hwReadWrite/stats_reset clears all counters and histograms
+ * */
+static ssize_t sysfs_store_stats_reset(struct device *dev, struct device_attribute *attr, const char *buffer, size_t count)
+{
+	hwrw_stats_reset();
+	return count;
+}
+
+/**
+ * This method is called when the user calls cat on /sys/kernel/hwReadWrite/shadow
+ * buffer: receives the counters of the shadow register cache, one "<counter> <value>" line each,
+ *         followed by one "<address> <registers> <policy> <cached registers>" line per range
+ * return value: the number of bytes written into buffer
+ * */
+static ssize_t sysfs_show_shadow(struct device *dev, struct device_attribute *attr, char *buffer)
+{
+	return hwrw_shadow_show(buffer);
+}
+
+/**
+ * This method is called when the user calls cat on /sys/kernel/hwReadWrite/programs
+ * buffer: receives one "<handle> <name> <operations>" line per stored program
+ * return value: the number of bytes written into buffer
+ * */
+static ssize_t sysfs_show_programs(struct device *dev, struct device_attribute *attr, char *buffer)
+{
+	return hwrw_programs_show(buffer);
+}
+
+/**
+ * The watch of a session, see hwrw_ioctl.h
+ * The register is pinned while the watch is armed or done, because the timer reads it in
+ * interrupt context. The timer only writes result and then state, and the ioctls only arm
+ * the watch when the timer is not running, so neither side needs a lock for the other.
+ * */
+enum watch_state
+{
+	watch_idle,
+	watch_armed,
+	watch_done
+};
+
+struct hwrw_watch_state
+{
+	struct hrtimer timer;
+	struct hwrw_watch request;
+	void __iomem *register_address;	/* NULL when the register is not pinned */
+	s64 started_ns;
+	s64 deadline_ns;
+	u64 interval_ns;
+	u64 max_interval_ns;
+	struct hwrw_watch_result result;
+	int state;
+	wait_queue_head_t wait;
+};
+
+/**
+ * Reads the watched register once
+ * return value: 1 when the watch is finished and its result is filled in, 0 otherwise
+ * */
+static int watch_check(struct hwrw_watch_state *watch)
+{
+	u32 value = hwrw_read(watch->register_address, register_size);
+	s64 now = hwrw_now_ns();
+
+	watch->result.polls++;
+	if ((value & watch->request.mask) == watch->request.value)
+	{
+		watch->result.result = 0;
+	}
+	else if (now >= watch->deadline_ns)
+	{
+		watch->result.result = -ETIMEDOUT;
+	}
+	else
+	{
+		return 0;
+	}
+	watch->result.value = value;
+	watch->result.elapsed_ns = now - watch->started_ns;
+	return 1;
+}
+
+static void watch_finish(struct hwrw_watch_state *watch)
+{
+	/* the result must be complete before poll and HWRW_IOC_WATCH_WAIT can see the new state */
+	smp_wmb();
+	watch->state = watch_done;
+	wake_up_interruptible(&watch->wait);
+	es6_trace_debug("watch_done", "address=0x%08x result=%d polls=%u", watch->request.address, watch->result.result, watch->result.polls);
+}
+
+/**
+ * hrtimer callback of a watch, runs in interrupt context
+ * */
+static enum hrtimer_restart watch_tick(struct hrtimer *timer)
+{
+	struct hwrw_watch_state *watch = container_of(timer, struct hwrw_watch_state, timer);
+	s64 remaining;
+
+	if (watch_check(watch))
+	{
+		watch_finish(watch);
+		return HRTIMER_NORESTART;
+	}
+
+	/* back off while the condition doesn't hold, but don't sleep past the deadline */
+	watch->interval_ns = min_t(u64, watch->interval_ns * 2, watch->max_interval_ns);
+	remaining = watch->deadline_ns - hwrw_now_ns();
+	hrtimer_forward_now(timer, ns_to_ktime(min_t(s64, watch->interval_ns, max_t(s64, remaining, 1))));
+	return HRTIMER_RESTART;
+}
+
+static void watch_unpin(struct hwrw_watch_state *watch)
+{
+	if (watch->register_address != NULL)
+	{
+		hwrw_unpin(watch->request.address);
+		watch->register_address = NULL;
+	}
+}
+
+/**
+ * Handles HWRW_IOC_WATCH, a finished watch whose result was not collected is replaced
+ * return value: 0 on success, or a negative error code
+ * */
+static long watch_arm(struct hwrw_session *session, const struct hwrw_watch __user *user_watch)
+{
+	struct hwrw_watch_state *watch = session->watch;
+	struct hwrw_watch request;
+	long result = 0;
+
+	if (copy_from_user(&request, user_watch, sizeof(request)) != 0)
+	{
+		return -EFAULT;
+	}
+	if ((request.address & (register_size - 1)) != 0 || request.timeout_us > HWRW_WATCH_MAX_TIMEOUT_US)
+	{
+		return -EINVAL;
+	}
+
+	mutex_lock(&session->lock);
+	if (!hwrw_session_allowed(session, request.address, register_size))
+	{
+		result = -EPERM;
+	}
+	else if (watch->state == watch_armed)
+	{
+		result = -EBUSY;
+	}
+	else
+	{
+		watch_unpin(watch);
+		watch->request = request;
+		watch->register_address = hwrw_pin(request.address);
+		memset(&watch->result, 0, sizeof(watch->result));
+		watch->started_ns = hwrw_now_ns();
+		watch->deadline_ns = watch->started_ns + (s64)request.timeout_us * NSEC_PER_USEC;
+		watch->interval_ns = HWRW_WATCH_MIN_INTERVAL_NS;
+		watch->max_interval_ns = max_t(u64, (u64)request.interval_us * NSEC_PER_USEC, HWRW_WATCH_MIN_INTERVAL_NS);
+		es6_trace_debug("watch", "address=0x%08x mask=0x%08x value=0x%08x timeout_us=%u interval_us=%u",
+			request.address, request.mask, request.value, request.timeout_us, request.interval_us);
+
+		if (watch_check(watch))
+		{
+			watch_finish(watch);
+		}
+		else
+		{
+			watch->state = watch_armed;
+			hrtimer_start(&watch->timer, ns_to_ktime(watch->interval_ns), HRTIMER_MODE_REL);
+		}
+	}
+	mutex_unlock(&session->lock);
+	return result;
+}
+
+/**
+ * Handles HWRW_IOC_WATCH_WAIT
+ * return value: 0 on success, -ENOENT when no watch is armed, -EAGAIN when the watch is not
+ *               finished and the file is non-blocking, or another negative error code
+ * */
+static long watch_wait(struct file *file, struct hwrw_watch_result __user *user_result)
+{
+	struct hwrw_session *session = file->private_data;
+	struct hwrw_watch_state *watch = session->watch;
+	struct hwrw_watch_result result;
+	int state;
+
+	for (;;)
+	{
+		mutex_lock(&session->lock);
+		state = watch->state;
+		if (state == watch_done)
+		{
+			break;
+		}
+		mutex_unlock(&session->lock);
+
+		if (state == watch_idle)
+		{
+			return -ENOENT;
+		}
+		if ((file->f_flags & O_NONBLOCK) != 0)
+		{
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(watch->wait, ACCESS_ONCE(watch->state) != watch_armed) != 0)
+		{
+			return -ERESTARTSYS;
+		}
+	}
+
+	smp_rmb();
+	result = watch->result;
+	watch->state = watch_idle;
+	watch_unpin(watch);
+	mutex_unlock(&session->lock);
+
+	return copy_to_user(user_result, &result, sizeof(result)) != 0 ? -EFAULT : 0;
+}
+
+/**
+ * This method is called when the user calls poll or select on /dev/hwrw
+ * return value: POLLPRI when the watch of the session is finished
+ * */
+static unsigned int device_poll(struct file *file, poll_table *wait)
+{
+	struct hwrw_session *session = file->private_data;
+
+	poll_wait(file, &session->watch->wait, wait);
+	if (ACCESS_ONCE(session->watch->state) == watch_done)
+	{
+		return POLLPRI;
+	}
+	return 0;
+}
+
+/**
+ * Every open of /dev/hwrw gets its own session, see hwrw_ioctl.h
+ * return value: 0 on success, -ENOMEM when the session could not be allocated
+ * */
+static int device_open(struct inode *inode, struct file *file)
+{
+	struct hwrw_session *session;
+	struct hwrw_watch_state *watch;
+
+	watch = kzalloc(sizeof(*watch), GFP_KERNEL);
+	if (watch == NULL)
+	{
+		return -ENOMEM;
+	}
+	session = hwrw_session_create();
+	if (session == NULL)
+	{
+		kfree(watch);
+		return -ENOMEM;
+	}
+	hrtimer_init(&watch->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	watch->timer.function = watch_tick;
+	init_waitqueue_head(&watch->wait);
+	session->watch = watch;
+	file->private_data = session;
+	return 0;
+}
+
+static void player_forget(struct hwrw_session *session);
+
+static int device_release(struct inode *inode, struct file *file)
+{
+	struct hwrw_session *session = file->private_data;
+
+	player_forget(session);
+	hrtimer_cancel(&session->watch->timer);
+	watch_unpin(session->watch);
+	kfree(session->watch);
+	hwrw_session_destroy(session);
+	return 0;
+}
+
+/**
+ * This method is called when the user writes a script to /dev/hwrw
+ * The commands are the same as for /sys/kernel/hwReadWrite/result, but a line may be split
+ * over several writes and the results are read with HWRW_IOC_OUTPUT.
+ * return value: the number of bytes handled, or a negative error code
+ * */
+static ssize_t device_write(struct file *file, const char __user *user_buffer, size_t count, loff_t *offset)
+{
+	char *buffer;
+	size_t size = min_t(size_t, count, max_data);
+
+	buffer = kmalloc(size, GFP_KERNEL);
+	if (buffer == NULL)
+	{
+		return -ENOMEM;
+	}
+	if (copy_from_user(buffer, user_buffer, size) != 0)
+	{
+		kfree(buffer);
+		return -EFAULT;
+	}
+	size = hwrw_session_write(file->private_data, buffer, size);
+	kfree(buffer);
+	return size;
+}
+
+/**
+ * This method is called when the user reads from /dev/hwrw
+ * The file offset is the physical address of the first register, so
+ * pread(fd, buffer, 8 * 4, 0x40024000) returns 8 raw 32-bit register values.
+ * user_buffer: the userspace buffer to fill with register values
+ * count: the number of bytes to read, must be a multiple of 4
+ * offset: the physical address to start at, must be 4 byte aligned
+ * return value: the number of bytes read, or a negative error code
+ * */
+static ssize_t device_read(struct file *file, char __user *user_buffer, size_t count, loff_t *offset)
+{
+	struct hwrw_session *session = file->private_data;
+	u32 values[device_chunk_registers];
+	loff_t start_address = *offset;
+	size_t done = 0;
+	int allowed;
+
+	if ((start_address & (register_size - 1)) != 0 || (count & (register_size - 1)) != 0)
+	{
+		return -EINVAL;
+	}
+	if (start_address + count > 0x100000000ULL)
+	{
+		return -EINVAL;
+	}
+	mutex_lock(&session->lock);
+	allowed = count == 0 || hwrw_session_allowed(session, (unsigned long)start_address, count);
+	mutex_unlock(&session->lock);
+	if (!allowed)
+	{
+		return -EPERM;
+	}
+
+	/* read in chunks so a few hundred registers cost a few copy_to_user calls */
+	while (done < count)
+	{
+		size_t i;
+		size_t chunk = min_t(size_t, count - done, sizeof(values));
+		unsigned long current_address = start_address + done;
+
+		hwrw_access_begin();
+		for (i = 0; i < chunk / register_size; i++)
+		{
+			values[i] = hwrw_read32(current_address + i * register_size);
+		}
+		hwrw_access_end();
+		if (copy_to_user(user_buffer + done, values, chunk) != 0)
+		{
+			return done ? done : -EFAULT;
+		}
+		done += chunk;
+	}
+
+	*offset += done;
+	hwrw_session_count(session, &session->stats.bytes_read, done);
+	hwrw_stats_add(&hwrw_stats.device_reads, 1);
+	hwrw_stats_add(&hwrw_stats.bytes_read, done);
+	return done;
+}
+
+/**
+ * Moves the file offset, which is the physical register address for /dev/hwrw
+ * There is no end of the device, so SEEK_END is not supported
+ * */
+static loff_t device_llseek(struct file *file, loff_t offset, int whence)
+{
+	loff_t new_offset;
+
+	switch (whence)
+	{
+	case SEEK_SET:
+		new_offset = offset;
+		break;
+	case SEEK_CUR:
+		new_offset = file->f_pos + offset;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (new_offset < 0 || new_offset > 0xffffffffLL)
+	{
+		return -EINVAL;
+	}
+
+	file->f_pos = new_offset;
+	return new_offset;
+}
+
+/**
+ * This method is called when the user calls mmap on /dev/hwrw
+ * The mmap offset is the physical address of the window, like for pread.
+ * The backend decides which ranges may be mapped, see hwrw_backend.c
+ * return value: 0 on success, or a negative error code
+ * */
+static int device_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct hwrw_session *session = file->private_data;
+	int allowed;
+
+	mutex_lock(&session->lock);
+	allowed = hwrw_session_allowed(session, vma->vm_pgoff << PAGE_SHIFT, vma->vm_end - vma->vm_start);
+	mutex_unlock(&session->lock);
+	if (!allowed)
+	{
+		return -EPERM;
+	}
+	return hwrw_backend->mmap(vma);
+}
+
+/**
+ * Handles HWRW_IOC_TRANSACTION: copies the operations in, runs them all with
+ * hwrw_transaction_run and copies the results back, also when an operation failed halfway
+ * return value: 0 on success, or the error of the first operation that failed
+ * */
+static long device_transaction(struct hwrw_session *session, struct hwrw_transaction __user *user_transaction)
+{
+	struct hwrw_transaction transaction;
+	struct hwrw_op *ops;
+	size_t ops_size;
+	int result = 0;
+
+	if (copy_from_user(&transaction, user_transaction, sizeof(transaction)) != 0)
+	{
+		return -EFAULT;
+	}
+	if (transaction.count == 0 || transaction.count > HWRW_MAX_OPS)
+	{
+		return -EINVAL;
+	}
+
+	ops_size = transaction.count * sizeof(*ops);
+	ops = kmalloc(ops_size, GFP_KERNEL);
+	if (ops == NULL)
+	{
+		return -ENOMEM;
+	}
+	if (copy_from_user(ops, (void __user *)(unsigned long)transaction.ops, ops_size) != 0)
+	{
+		kfree(ops);
+		return -EFAULT;
+	}
+
+	result = hwrw_session_transaction(session, ops, transaction.count, &transaction.completed);
+
+	if (copy_to_user((void __user *)(unsigned long)transaction.ops, ops, ops_size) != 0 ||
+	    put_user(transaction.completed, &user_transaction->completed) != 0)
+	{
+		result = -EFAULT;
+	}
+	kfree(ops);
+	return result;
+}
+
+/**
+ * Handles HWRW_IOC_OUTPUT: moves output of the session to userspace
+ * return value: 0 on success, or a negative error code
+ * */
+static long device_output(struct hwrw_session *session, struct hwrw_output __user *user_output)
+{
+	struct hwrw_output output;
+	char *buffer;
+	long result = 0;
+
+	if (copy_from_user(&output, user_output, sizeof(output)) != 0)
+	{
+		return -EFAULT;
+	}
+	buffer = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (buffer == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	output.used = hwrw_session_take_output(session, buffer, min_t(size_t, output.size, PAGE_SIZE));
+	if (copy_to_user((void __user *)(unsigned long)output.data, buffer, output.used) != 0 ||
+	    put_user(output.used, &user_output->used) != 0)
+	{
+		result = -EFAULT;
+	}
+	kfree(buffer);
+	return result;
+}
+
+/**
+ * Handles HWRW_IOC_SNAPSHOT_DIFF
+ * return value: 0 on success, or a negative error code
+ * */
+static long device_diff(struct hwrw_session *session, struct hwrw_diff __user *user_diff)
+{
+	struct hwrw_diff diff;
+	struct hwrw_diff_record *records;
+	long result = 0;
+	int changed;
+
+	if (copy_from_user(&diff, user_diff, sizeof(diff)) != 0)
+	{
+		return -EFAULT;
+	}
+	if (diff.max_records > HWRW_MAX_DIFF_RECORDS)
+	{
+		return -EINVAL;
+	}
+	diff.name[HWRW_SNAPSHOT_NAME - 1] = '\0';
+	records = vmalloc(max_t(u32, diff.max_records, 1) * sizeof(*records));
+	if (records == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	changed = hwrw_session_diff(session, diff.name, records, diff.max_records, &diff.count);
+	if (changed < 0)
+	{
+		result = changed;
+	}
+	else
+	{
+		diff.changed = changed;
+		if (copy_to_user((void __user *)(unsigned long)diff.records, records, diff.count * sizeof(*records)) != 0 ||
+		    copy_to_user(user_diff, &diff, sizeof(diff)) != 0)
+		{
+			result = -EFAULT;
+		}
+	}
+	vfree(records);
+	return result;
+}
+
+/**
+ * Handles HWRW_IOC_CAPTURE, the stream is collected in a kernel buffer during the burst
+ * return value: 0 on success, or a negative error code
+ * */
+static long device_capture(struct hwrw_session *session, struct hwrw_capture __user *user_capture)
+{
+	struct hwrw_capture capture;
+	u8 *buffer;
+	long result;
+
+	if (copy_from_user(&capture, user_capture, sizeof(capture)) != 0)
+	{
+		return -EFAULT;
+	}
+	if (capture.size > HWRW_CAPTURE_MAX_BYTES)
+	{
+		return -EINVAL;
+	}
+	buffer = vmalloc(max_t(u32, capture.size, 1));
+	if (buffer == NULL)
+	{
+		return -ENOMEM;
+	}
+
+	result = hwrw_session_capture(session, &capture, buffer);
+	if (result == 0)
+	{
+		if (copy_to_user((void __user *)(unsigned long)capture.data, buffer, capture.used) != 0 ||
+		    copy_to_user(user_capture, &capture, sizeof(capture)) != 0)
+		{
+			result = -EFAULT;
+		}
+	}
+	vfree(buffer);
+	return result;
+}
+
+/**
+ * Handles HWRW_IOC_PROGRAM_LOAD, the text is copied into a kernel buffer and compiled from there
+ * return value: 0 on success, or a negative error code
+ * */
+static long device_program_load(struct hwrw_program_load __user *user_load)
+{
+	struct hwrw_program_load load;
+	char *text;
+	long result;
+
+	if (copy_from_user(&load, user_load, sizeof(load)) != 0)
+	{
+		return -EFAULT;
+	}
+	if (load.size > HWRW_PROGRAM_MAX_TEXT)
+	{
+		return -EINVAL;
+	}
+	load.name[HWRW_PROGRAM_NAME - 1] = '\0';
+	text = vmalloc(max_t(u32, load.size, 1));
+	if (text == NULL)
+	{
+		return -ENOMEM;
+	}
+	if (copy_from_user(text, (void __user *)(unsigned long)load.text, load.size) != 0)
+	{
+		vfree(text);
+		return -EFAULT;
+	}
+
+	result = hwrw_program_load(load.name, text, load.size, &load.error_line);
+	vfree(text);
+	load.handle = result;
+	if (copy_to_user(user_load, &load, sizeof(load)) != 0)
+	{
+		/* nobody can learn the handle, so nobody could free the program */
+		if (result >= 0)
+		{
+			hwrw_program_free(result);
+		}
+		return -EFAULT;
+	}
+	return result < 0 ? result : 0;
+}
+
+/**
+ * The waveform player, see hwrw_ioctl.h
+ * The registers of a waveform are pinned when it is loaded, because the timer writes them in
+ * interrupt context. active is only used by the timer while the player runs. The timer takes
+ * queued over at the end of a pass and hands the waveform it replaces to retired, which
+ * player_retire_work frees in process context. swap_lock protects queued and retired.
+ * The timer can't go through the shadow cache, so a waveform claims [first, last] from it
+ * while it is loaded, see hwrw_shadow.c.
+ * The player is shared, but only owner, the session that loaded the last waveform, and
+ * sessions whose window covers every loaded waveform may load, start or stop it.
+ * */
+struct wave
+{
+	u32 count;
+	u32 flags;
+	struct hwrw_wave_step *steps;
+	void __iomem **registers;
+	u32 first;
+	u32 last;
+	int claimed;
+};
+
+struct player
+{
+	struct hrtimer timer;
+	struct wave *active;
+	struct wave *queued;
+	struct wave *retired;
+	u32 position;
+	int playing;
+	u64 steps;
+	u32 passes;
+	u32 late;
+	u32 max_late_ns;
+	spinlock_t swap_lock;
+	struct mutex lock;	/* serializes the ioctls, not taken by the timer */
+	struct hwrw_session *owner;	/* protected by lock */
+};
+
+static struct player player = {
+	.swap_lock = __SPIN_LOCK_UNLOCKED(player.swap_lock),
+	.lock = __MUTEX_INITIALIZER(player.lock),
+};
+
+static void wave_free(struct wave *wave)
+{
+	u32 i;
+
+	if (wave == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < wave->count; i++)
+	{
+		hwrw_unpin(wave->steps[i].address);
+	}
+	if (wave->claimed)
+	{
+		hwrw_shadow_release(wave->first, wave->last);
+	}
+	vfree(wave->steps);
+	kfree(wave->registers);
+	kfree(wave);
+}
+
+static void player_retire(struct work_struct *work)
+{
+	struct wave *wave;
+	unsigned long flags;
+
+	spin_lock_irqsave(&player.swap_lock, flags);
+	wave = player.retired;
+	player.retired = NULL;
+	spin_unlock_irqrestore(&player.swap_lock, flags);
+
+	wave_free(wave);
+}
+
+static DECLARE_WORK(player_retire_work, player_retire);
+
+/**
+ * hrtimer callback, runs in interrupt context at the time of the next step
+ * The next expiry is computed from the previous one and not from now, so late timer
+ * interrupts don't add up over a long waveform.
+ * */
+static enum hrtimer_restart player_tick(struct hrtimer *timer)
+{
+	struct wave *wave = player.active;
+	s64 late_ns = ktime_to_ns(ktime_sub(ktime_get(), hrtimer_get_expires(timer)));
+
+	if (late_ns > HWRW_WAVE_LATE_NS)
+	{
+		player.late++;
+	}
+	if (late_ns > player.max_late_ns)
+	{
+		player.max_late_ns = late_ns;
+	}
+
+	do
+	{
+		hwrw_write(wave->registers[player.position], wave->steps[player.position].value, register_size);
+		player.steps++;
+
+		if (++player.position == wave->count)
+		{
+			player.position = 0;
+			player.passes++;
+
+			spin_lock(&player.swap_lock);
+			if (player.queued != NULL && player.retired == NULL)
+			{
+				player.retired = wave;
+				wave = player.active = player.queued;
+				player.queued = NULL;
+				schedule_work(&player_retire_work);
+			}
+			else if ((wave->flags & HWRW_WAVE_LOOP) == 0)
+			{
+				player.playing = 0;
+				spin_unlock(&player.swap_lock);
+				return HRTIMER_NORESTART;
+			}
+			spin_unlock(&player.swap_lock);
+		}
+	}
+	while (wave->steps[player.position].delay_ns == 0);
+
+	hrtimer_set_expires(timer, ktime_add_ns(hrtimer_get_expires(timer), wave->steps[player.position].delay_ns));
+	return HRTIMER_RESTART;
+}
+
+static int wave_covered(struct hwrw_session *session, struct wave *wave)
+{
+	return wave == NULL || hwrw_session_allowed(session, wave->first, wave->last - wave->first + 1);
+}
+
+/**
+ * Must be called with player.lock held
+ * return value: 1 when session may load, start or stop the player
+ * */
+static int player_may_control(struct hwrw_session *session)
+{
+	unsigned long flags;
+	int allowed;
+
+	if (player.owner == session)
+	{
+		return 1;
+	}
+	/* the timer may swap queued in, but a waveform is only freed after it was taken under swap_lock */
+	mutex_lock(&session->lock);
+	spin_lock_irqsave(&player.swap_lock, flags);
+	allowed = wave_covered(session, player.active) && wave_covered(session, player.queued);
+	spin_unlock_irqrestore(&player.swap_lock, flags);
+	mutex_unlock(&session->lock);
+	return allowed;
+}
+
+/**
+ * A session that is closed doesn't own the player anymore, its waveform plays on
+ * */
+static void player_forget(struct hwrw_session *session)
+{
+	mutex_lock(&player.lock);
+	if (player.owner == session)
+	{
+		player.owner = NULL;
+	}
+	mutex_unlock(&player.lock);
+}
+
+static void player_stop(void)
+{
+	hrtimer_cancel(&player.timer);
+	player.playing = 0;
+}
+
+/**
+ * Handles HWRW_IOC_WAVE_LOAD, every step must lie in the window of the session
+ * return value: 0 on success, -EBUSY when a register of the waveform has a shadow policy,
+ *               -EPERM when the session may not replace the loaded waveform, or another
+ *               negative error code
+ * */
+static long player_load(struct hwrw_session *session, const struct hwrw_wave __user *user_wave)
+{
+	struct hwrw_wave request;
+	struct wave *wave;
+	struct wave *replaced;
+	unsigned long flags;
+	u64 pass_ns = 0;
+	int allowed = 1;
+	int result;
+	u32 i;
+
+	if (copy_from_user(&request, user_wave, sizeof(request)) != 0)
+	{
+		return -EFAULT;
+	}
+	if (request.count == 0 || request.count > HWRW_WAVE_MAX_STEPS || (request.flags & ~HWRW_WAVE_LOOP) != 0)
+	{
+		return -EINVAL;
+	}
+
+	wave = kzalloc(sizeof(*wave), GFP_KERNEL);
+	if (wave == NULL)
+	{
+		return -ENOMEM;
+	}
+	wave->flags = request.flags;
+	wave->steps = vmalloc(request.count * sizeof(*wave->steps));
+	wave->registers = kmalloc(request.count * sizeof(*wave->registers), GFP_KERNEL);
+	if (wave->steps == NULL || wave->registers == NULL)
+	{
+		wave_free(wave);
+		return -ENOMEM;
+	}
+	if (copy_from_user(wave->steps, (const void __user *)(unsigned long)request.steps, request.count * sizeof(*wave->steps)) != 0)
+	{
+		wave_free(wave);
+		return -EFAULT;
+	}
+
+	wave->first = wave->steps[0].address;
+	wave->last = wave->steps[0].address;
+	mutex_lock(&session->lock);
+	for (i = 0; i < request.count && allowed; i++)
+	{
+		allowed = (wave->steps[i].address & (register_size - 1)) == 0 &&
+			hwrw_session_allowed(session, wave->steps[i].address, register_size);
+		pass_ns += wave->steps[i].delay_ns;
+		wave->first = min(wave->first, wave->steps[i].address);
+		wave->last = max(wave->last, wave->steps[i].address + (register_size - 1));
+	}
+	mutex_unlock(&session->lock);
+	if (!allowed)
+	{
+		wave_free(wave);
+		return -EPERM;
+	}
+	if ((wave->flags & HWRW_WAVE_LOOP) != 0 && pass_ns < HWRW_WAVE_MIN_LOOP_NS)
+	{
+		/* the timer would write the loop over and over without ever leaving the interrupt */
+		wave_free(wave);
+		return -EINVAL;
+	}
+	result = hwrw_shadow_claim(wave->first, wave->last);
+	if (result != 0)
+	{
+		wave_free(wave);
+		return result;
+	}
+	wave->claimed = 1;
+
+	for (i = 0; i < request.count; i++)
+	{
+		wave->registers[i] = hwrw_pin(wave->steps[i].address);
+		wave->count = i + 1;
+	}
+
+	mutex_lock(&player.lock);
+	if (!player_may_control(session))
+	{
+		mutex_unlock(&player.lock);
+		wave_free(wave);
+		return -EPERM;
+	}
+	player.owner = session;
+	if (player.playing)
+	{
+		spin_lock_irqsave(&player.swap_lock, flags);
+		replaced = player.queued;
+		player.queued = wave;
+		spin_unlock_irqrestore(&player.swap_lock, flags);
+	}
+	else
+	{
+		/* the timer is not running, so the player is ours */
+		replaced = player.active;
+		player.active = wave;
+		wave_free(player.queued);
+		player.queued = NULL;
+	}
+	mutex_unlock(&player.lock);
+
+	wave_free(replaced);
+	es6_trace_info("wave_load", "steps=%u flags=%u pass_ns=%llu", wave->count, wave->flags, (unsigned long long)pass_ns);
+	return 0;
+}
+
+/**
+ * Handles HWRW_IOC_WAVE_START, HWRW_IOC_WAVE_STOP and HWRW_IOC_WAVE_STATUS
+ * return value: 0 on success, -EPERM when the session may not start or stop the player,
+ *               or another negative error code
+ * */
+static long player_ioctl(struct hwrw_session *session, unsigned int command, unsigned long argument)
+{
+	struct hwrw_wave_status status;
+	long result = 0;
+
+	mutex_lock(&player.lock);
+	if (command != HWRW_IOC_WAVE_STATUS && !player_may_control(session))
+	{
+		mutex_unlock(&player.lock);
+		return -EPERM;
+	}
+	switch (command)
+	{
+	case HWRW_IOC_WAVE_START:
+		if (player.playing)
+		{
+			result = -EBUSY;
+			break;
+		}
+		if (player.queued != NULL)
+		{
+			/* queued while the last pass was played, the timer is not running anymore */
+			wave_free(player.active);
+			player.active = player.queued;
+			player.queued = NULL;
+		}
+		if (player.active == NULL)
+		{
+			result = -EINVAL;
+		}
+		else
+		{
+			player.position = 0;
+			player.steps = 0;
+			player.passes = 0;
+			player.late = 0;
+			player.max_late_ns = 0;
+			player.playing = 1;
+			hrtimer_start(&player.timer, ns_to_ktime(player.active->steps[0].delay_ns), HRTIMER_MODE_REL);
+		}
+		break;
+	case HWRW_IOC_WAVE_STOP:
+		player_stop();
+		break;
+	case HWRW_IOC_WAVE_STATUS:
+		memset(&status, 0, sizeof(status));
+		status.steps = player.steps;
+		status.passes = ACCESS_ONCE(player.passes);
+		status.late = ACCESS_ONCE(player.late);
+		status.max_late_ns = ACCESS_ONCE(player.max_late_ns);
+		status.playing = ACCESS_ONCE(player.playing);
+		status.queued = ACCESS_ONCE(player.queued) != NULL;
+		if (copy_to_user((void __user *)argument, &status, sizeof(status)) != 0)
+		{
+			result = -EFAULT;
+		}
+		break;
+	}
+	mutex_unlock(&player.lock);
+	return result;
+}
+
+/**
+ * Stops the player and frees all waveforms, at module exit
+ * */
+static void player_exit(void)
+{
+	player_stop();
+	flush_scheduled_work();
+	wave_free(player.active);
+	wave_free(player.queued);
+	wave_free(player.retired);
+}
+
+/**
+ * This method is called when the user calls ioctl on /dev/hwrw
+ * return value: 0 on success, or a negative error code
+ * */
+static long device_ioctl(struct file *file, unsigned int command, unsigned long argument)
+{
+	struct hwrw_session *session = file->private_data;
+	struct hwrw_window window;
+	struct hwrw_session_stats stats;
+
+	switch (command)
+	{
+	case HWRW_IOC_TRANSACTION:
+		return device_transaction(session, (struct hwrw_transaction __user *)argument);
+	case HWRW_IOC_SET_WINDOW:
+		if (copy_from_user(&window, (void __user *)argument, sizeof(window)) != 0)
+		{
+			return -EFAULT;
+		}
+		return hwrw_session_set_window(session, window.base, window.size);
+	case HWRW_IOC_OUTPUT:
+		return device_output(session, (struct hwrw_output __user *)argument);
+	case HWRW_IOC_SESSION_STATS:
+		mutex_lock(&session->lock);
+		stats = session->stats;
+		mutex_unlock(&session->lock);
+		return copy_to_user((void __user *)argument, &stats, sizeof(stats)) != 0 ? -EFAULT : 0;
+	case HWRW_IOC_SNAPSHOT_DIFF:
+		return device_diff(session, (struct hwrw_diff __user *)argument);
+	case HWRW_IOC_WATCH:
+		return watch_arm(session, (const struct hwrw_watch __user *)argument);
+	case HWRW_IOC_WATCH_WAIT:
+		return watch_wait(file, (struct hwrw_watch_result __user *)argument);
+	case HWRW_IOC_CAPTURE:
+		return device_capture(session, (struct hwrw_capture __user *)argument);
+	case HWRW_IOC_WAVE_LOAD:
+		return player_load(session, (const struct hwrw_wave __user *)argument);
+	case HWRW_IOC_WAVE_START:
+	case HWRW_IOC_WAVE_STOP:
+	case HWRW_IOC_WAVE_STATUS:
+		return player_ioctl(session, command, argument);
+	case HWRW_IOC_PROGRAM_LOAD:
+		return device_program_load((struct hwrw_program_load __user *)argument);
+	case HWRW_IOC_PROGRAM_FREE:
+		return hwrw_program_free(argument);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations device_fops = {
+	.owner = THIS_MODULE,
+	.open = device_open,
+	.release = device_release,
+	.llseek = device_llseek,
+	.read = device_read,
+	.write = device_write,
+	.poll = device_poll,
+	.mmap = device_mmap,
+	.unlocked_ioctl = device_ioctl,
+};
+
+/**
+ * /dev/hwrw is a misc device, so we get a dynamic minor and the node from udev/mdev
+ * */
+static struct miscdevice hwrw_device = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = device_name,
+	.fops = &device_fops,
+};
+
+/**
+ * The sampler reads a list of registers from an hrtimer into a single producer,
+ * single consumer ring. The timer callback only writes head and the reader of
+ * /dev/hwrw_sampler only writes tail, so neither side needs a lock.
+ * */
+struct sampler
+{
+	struct hrtimer timer;
+	ktime_t period;
+	u32 addresses[HWRW_SAMPLER_MAX_REGS];
+	void __iomem *registers[HWRW_SAMPLER_MAX_REGS];	/* pinned, the timer can not map anything */
+	unsigned int count;
+	unsigned int wakeup_threshold;
+	struct hwrw_sample *ring;
+	unsigned int ring_entries;
+	unsigned int head;
+	unsigned int tail;
+	u32 sequence;
+	u32 samples;
+	u32 dropped;
+	u32 missed;
+	int running;
+	wait_queue_head_t wait;
+	struct mutex lock;	/* serializes ioctl and read, not taken by the timer */
+	atomic_t opened;
+};
+
+static struct sampler sampler;
+
+/**
+ * hrtimer callback, runs in interrupt context every sampler.period
+ * When the ring is full the sample is dropped, the reader sees a gap in sequence.
+ * */
+static enum hrtimer_restart sampler_tick(struct hrtimer *timer)
+{
+	unsigned int head = sampler.head;
+	unsigned long overruns;
+
+	if (head - ACCESS_ONCE(sampler.tail) >= sampler.ring_entries)
+	{
+		sampler.dropped++;
+	}
+	else
+	{
+		struct hwrw_sample *sample = &sampler.ring[head & (sampler.ring_entries - 1)];
+		unsigned int i;
+
+		sample->timestamp_ns = ktime_to_ns(ktime_get());
+		sample->sequence = sampler.sequence;
+		sample->missed = sampler.missed;
+		for (i = 0; i < sampler.count; i++)
+		{
+			sample->values[i] = hwrw_read(sampler.registers[i], register_size);
+		}
+
+		/* the record must be complete before the reader can see the new head */
+		smp_wmb();
+		sampler.head = head + 1;
+		sampler.samples++;
+
+		if (head + 1 - ACCESS_ONCE(sampler.tail) >= sampler.wakeup_threshold)
+		{
+			wake_up_interruptible(&sampler.wait);
+		}
+	}
+	sampler.sequence++;
+
+	overruns = hrtimer_forward_now(timer, sampler.period);
+	if (overruns > 1)
+	{
+		sampler.missed += overruns - 1;
+		sampler.sequence += overruns - 1;
+	}
+	return HRTIMER_RESTART;
+}
+
+/**
+ * Stops the timer and wakes up a blocked reader so it can return what is left
+ * */
+static void sampler_stop(void)
+{
+	if (sampler.running)
+	{
+		hrtimer_cancel(&sampler.timer);
+		sampler.running = 0;
+		wake_up_interruptible(&sampler.wait);
+	}
+}
+
+static void sampler_unpin(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sampler.count; i++)
+	{
+		hwrw_unpin(sampler.addresses[i]);
+	}
+	sampler.count = 0;
+}
+
+/**
+ * Handles HWRW_IOC_SAMPLER_CONFIG, the sampler must be stopped
+ * A new ring is allocated, so queued samples of the previous configuration are dropped
+ * */
+static long sampler_configure(const struct hwrw_sampler_config __user *user_config)
+{
+	struct hwrw_sampler_config config;
+	struct hwrw_sample *ring;
+	unsigned int i;
+
+	if (copy_from_user(&config, user_config, sizeof(config)) != 0)
+	{
+		return -EFAULT;
+	}
+	if (config.count == 0 || config.count > HWRW_SAMPLER_MAX_REGS ||
+	    config.period_ns < HWRW_SAMPLER_MIN_PERIOD_NS ||
+	    config.ring_entries < 2 || config.ring_entries > HWRW_SAMPLER_MAX_ENTRIES ||
+	    (config.ring_entries & (config.ring_entries - 1)) != 0 ||
+	    config.wakeup_threshold > config.ring_entries)
+	{
+		return -EINVAL;
+	}
+	for (i = 0; i < config.count; i++)
+	{
+		if ((config.addresses[i] & (register_size - 1)) != 0)
+		{
+			return -EINVAL;
+		}
+	}
+	if (sampler.running)
+	{
+		return -EBUSY;
+	}
+
+	ring = vmalloc(config.ring_entries * sizeof(*ring));
+	if (ring == NULL)
+	{
+		return -ENOMEM;
+	}
+	vfree(sampler.ring);
+	sampler_unpin();
+
+	sampler.ring = ring;
+	sampler.ring_entries = config.ring_entries;
+	sampler.period = ns_to_ktime(config.period_ns);
+	sampler.count = config.count;
+	sampler.wakeup_threshold = config.wakeup_threshold ? config.wakeup_threshold : 1;
+	memcpy(sampler.addresses, config.addresses, sizeof(sampler.addresses));
+	for (i = 0; i < sampler.count; i++)
+	{
+		sampler.registers[i] = hwrw_pin(sampler.addresses[i]);
+	}
+	sampler.head = 0;
+	sampler.tail = 0;
+	return 0;
+}
+
+/**
+ * This method is called when the user calls ioctl on /dev/hwrw_sampler
+ * return value: 0 on success, or a negative error code
+ * */
+static long sampler_ioctl(struct file *file, unsigned int command, unsigned long argument)
+{
+	struct hwrw_sampler_stats stats;
+	long result = 0;
+
+	mutex_lock(&sampler.lock);
+	switch (command)
+	{
+	case HWRW_IOC_SAMPLER_CONFIG:
+		result = sampler_configure((const struct hwrw_sampler_config __user *)argument);
+		break;
+	case HWRW_IOC_SAMPLER_START:
+		if (sampler.ring == NULL)
+		{
+			result = -EINVAL;
+		}
+		else if (!sampler.running)
+		{
+			sampler.sequence = 0;
+			sampler.samples = 0;
+			sampler.dropped = 0;
+			sampler.missed = 0;
+			sampler.running = 1;
+			hrtimer_start(&sampler.timer, sampler.period, HRTIMER_MODE_REL);
+		}
+		break;
+	case HWRW_IOC_SAMPLER_STOP:
+		sampler_stop();
+		break;
+	case HWRW_IOC_SAMPLER_STATS:
+		stats.samples = ACCESS_ONCE(sampler.samples);
+		stats.dropped = ACCESS_ONCE(sampler.dropped);
+		stats.missed = ACCESS_ONCE(sampler.missed);
+		stats.queued = ACCESS_ONCE(sampler.head) - sampler.tail;
+		if (copy_to_user((void __user *)argument, &stats, sizeof(stats)) != 0)
+		{
+			result = -EFAULT;
+		}
+		break;
+	default:
+		result = -ENOTTY;
+		break;
+	}
+	mutex_unlock(&sampler.lock);
+	return result;
+}
+
+/**
+ * This method is called when the user reads from /dev/hwrw_sampler
+ * Only whole struct hwrw_sample records are returned. A blocking read waits until
+ * at least one record is queued, or returns 0 when the sampler is stopped and empty.
+ * */
+static ssize_t sampler_read(struct file *file, char __user *user_buffer, size_t count, loff_t *offset)
+{
+	size_t copied = 0;
+	unsigned int head;
+	unsigned int tail;
+
+	if (count < sizeof(struct hwrw_sample))
+	{
+		return -EINVAL;
+	}
+	if (mutex_lock_interruptible(&sampler.lock) != 0)
+	{
+		return -ERESTARTSYS;
+	}
+
+	while (ACCESS_ONCE(sampler.head) == sampler.tail)
+	{
+		int running = sampler.running;
+
+		mutex_unlock(&sampler.lock);
+		if (!running)
+		{
+			return 0;
+		}
+		if (file->f_flags & O_NONBLOCK)
+		{
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(sampler.wait, ACCESS_ONCE(sampler.head) != sampler.tail || !sampler.running) != 0)
+		{
+			return -ERESTARTSYS;
+		}
+		if (mutex_lock_interruptible(&sampler.lock) != 0)
+		{
+			return -ERESTARTSYS;
+		}
+	}
+
+	head = ACCESS_ONCE(sampler.head);
+	tail = sampler.tail;
+	/* read the records only after seeing the head that published them */
+	smp_rmb();
+	while (tail != head && copied + sizeof(struct hwrw_sample) <= count)
+	{
+		if (copy_to_user(user_buffer + copied, &sampler.ring[tail & (sampler.ring_entries - 1)], sizeof(struct hwrw_sample)) != 0)
+		{
+			break;
+		}
+		copied += sizeof(struct hwrw_sample);
+		tail++;
+	}
+	/* the records must be copied before the timer may overwrite them */
+	smp_mb();
+	sampler.tail = tail;
+	mutex_unlock(&sampler.lock);
+
+	return copied ? copied : -EFAULT;
+}
+
+/**
+ * This method is called when the user calls poll or select on /dev/hwrw_sampler
+ * */
+static unsigned int sampler_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &sampler.wait, wait);
+	if (ACCESS_ONCE(sampler.head) != ACCESS_ONCE(sampler.tail))
+	{
+		return POLLIN | POLLRDNORM;
+	}
+	return 0;
+}
+
+/**
+ * The sampler ring has a single consumer, so only one process may open /dev/hwrw_sampler
+ * */
+static int sampler_open(struct inode *inode, struct file *file)
+{
+	if (atomic_cmpxchg(&sampler.opened, 0, 1) != 0)
+	{
+		return -EBUSY;
+	}
+	return 0;
+}
+
+static int sampler_release(struct inode *inode, struct file *file)
+{
+	mutex_lock(&sampler.lock);
+	sampler_stop();
+	mutex_unlock(&sampler.lock);
+	atomic_set(&sampler.opened, 0);
+	return 0;
+}
+
+static const struct file_operations sampler_fops = {
+	.owner = THIS_MODULE,
+	.open = sampler_open,
+	.release = sampler_release,
+	.read = sampler_read,
+	.poll = sampler_poll,
+	.unlocked_ioctl = sampler_ioctl,
+};
+
+static struct miscdevice sampler_device = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = sampler_device_name,
+	.fops = &sampler_fops,
+};
+
+/**
+ * result =  our file where we store user input  /sys/kernel/hwReadWrite/result
+ * S_IWUGO =  our kernel only requires write permissions for that reason S_IWUGO
+ * NULL =  we dont have to read from our kernel file
+ * sysfs_store =  The method that should be called when we echo to the kernel
+ * output = the results of the last script written to result /sys/kernel/hwReadWrite/output
+ * ring = every register read since the last time the ring was drained /sys/kernel/hwReadWrite/ring
+ * stats, stats_enable and stats_reset = instrumentation of the access paths
+ * shadow = the ranges and counters of the shadow register cache
+ * programs = the stored programs that "x <handle>" runs
+ **/
+static DEVICE_ATTR(result, S_IWUGO, NULL, sysfs_store);
+static DEVICE_ATTR(output, S_IRUGO, sysfs_show_output, NULL);
+static DEVICE_ATTR(ring, S_IRUGO, sysfs_show_ring, NULL);
+static DEVICE_ATTR(stats, S_IRUGO, sysfs_show_stats, NULL);
+static DEVICE_ATTR(stats_enable, S_IWUSR | S_IRUGO, sysfs_show_stats_enable, sysfs_store_stats_enable);
+static DEVICE_ATTR(stats_reset, S_IWUSR, NULL, sysfs_store_stats_reset);
+static DEVICE_ATTR(shadow, S_IRUGO, sysfs_show_shadow, NULL);
+static DEVICE_ATTR(programs, S_IRUGO, sysfs_show_programs, NULL);
+static struct attribute *attrs[] = {
+	&dev_attr_result.attr,
+	&dev_attr_output.attr,
+	&dev_attr_ring.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_stats_enable.attr,
+	&dev_attr_stats_reset.attr,
+	&dev_attr_shadow.attr,
+	&dev_attr_programs.attr,
+	NULL
+};
+static struct attribute_group attr_group = {.attrs = attrs,};
+static struct kobject *this_obj = NULL;
+    
+int __init sysfs_init(void)
+{
+    int result = 0;
+
+	/**
+	 * select the register backend first, everything below accesses registers through it
+	 **/
+    result = hwrw_backend_init();
+    if (result != 0)
+    {
+        printk (KERN_INFO "%s register backend could not be initialized %d\n", hwrw_backend_name, result);
+        return result;
+    }
+    
+	/**
+	 * Here we write our kernel into the kobject pointer
+	 * the 2nd parameter here implies that our kernel should be stored in /sys/kernel/
+	 **/
+    this_obj = kobject_create_and_add(kernel_dir, kernel_kobj);
+    
+    if (this_obj == NULL)
+    {
+        printk (KERN_INFO "%s kernel module could not be created \n", kernel_dir);
+        result = -ENOMEM;
+        goto exit_backend;
+    }
+	
+	/**
+	 * inject our result file into the kernel folder that was created earlier
+	 **/
+    result = sysfs_create_group(this_obj, &attr_group);
+    if (result != 0)
+    {
+        printk (KERN_INFO "%s could not create kernel filesystem %d\n", kernel_file, result);
+        result = -ENOMEM;
+        goto exit_kobject;
+    }
+
+	/**
+	 * register /dev/hwrw for binary register reads, the sysfs result file stays available
+	 * its ioctls include the waveform player, so the player timer must be ready first
+	 **/
+    hrtimer_init(&player.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    player.timer.function = player_tick;
+    result = misc_register(&hwrw_device);
+    if (result != 0)
+    {
+        printk (KERN_INFO "/dev/%s could not be registered %d\n", device_name, result);
+        goto exit_kobject;
+    }
+
+	/**
+	 * register /dev/hwrw_sampler for periodic sampling, its timer is only started on request
+	 **/
+    mutex_init(&sampler.lock);
+    init_waitqueue_head(&sampler.wait);
+    hrtimer_init(&sampler.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    sampler.timer.function = sampler_tick;
+    result = misc_register(&sampler_device);
+    if (result != 0)
+    {
+        printk (KERN_INFO "/dev/%s could not be registered %d\n", sampler_device_name, result);
+        goto exit_device;
+    }
+
+	/**
+	 * register /dev/hwrw_ring for register operations through shared memory
+	 **/
+    result = hwrw_ring_init();
+    if (result != 0)
+    {
+        goto exit_sampler;
+    }
+
+    printk(KERN_INFO "/sys/kernel/%s/%s created\n", kernel_dir, kernel_file);
+    printk(KERN_INFO "/sys/kernel/%s/%s created\n", kernel_dir, output_file);
+    printk(KERN_INFO "/sys/kernel/%s/%s created\n", kernel_dir, ring_file);
+    printk(KERN_INFO "/dev/%s created\n", device_name);
+    printk(KERN_INFO "/dev/%s created\n", sampler_device_name);
+    printk(KERN_INFO "using the %s register backend\n", hwrw_backend->name);
+    return result;
+
+exit_sampler:
+    misc_deregister(&sampler_device);
+exit_device:
+    misc_deregister(&hwrw_device);
+exit_kobject:
+    kobject_put(this_obj);
+exit_backend:
+    hwrw_backend_exit();
+    return result;
+}
+
+void __exit sysfs_exit(void)
+{
+    hwrw_ring_exit();
+    misc_deregister(&sampler_device);
+    vfree(sampler.ring);
+    sampler_unpin();
+    misc_deregister(&hwrw_device);
+    player_exit();
+    kobject_put(this_obj);
+    hwrw_session_free_snapshots(&hwrw_default_session);
+    hwrw_programs_exit();
+    hwrw_shadow_exit();
+    hwrw_backend_exit();
+    printk (KERN_INFO "/sys/kernel/%s/%s removed\n", kernel_dir, kernel_file);
+}
+
+module_init(sysfs_init);
+module_exit(sysfs_exit);
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_AUTHOR("Johri&Mark with help from Freddy");
+MODULE_DESCRIPTION("hwReadWrite");
@@ -0,0 +1,336 @@
+/**
+ * hwrw_ring.c - /dev/hwrw_ring, register operations through shared memory rings (kernel only)
+ * See hwrw_ioctl.h for the layout and the protocol. Every open has its own session, rings
+ * and worker thread. The worker copies a batch of submissions into kernel memory before it
+ * looks at them, so userspace can't change an operation after it was checked, and runs the
+ * batch with hwrw_session_transaction.
+ * */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+
+#include "hwReadWrite.h"
+
+#define ring_device_name "hwrw_ring"
+#define ring_batch 16	/* operations per transaction, they are copied to the stack */
+
+/**
+ * How long the worker keeps looking for new submissions before it goes idle. Work that
+ * arrives within this time needs no doorbell.
+ * */
+static unsigned int ring_idle_us = 200;
+module_param(ring_idle_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(ring_idle_us, "time the /dev/hwrw_ring worker polls before it sleeps (default 200)");
+
+struct ring
+{
+	struct hwrw_session *session;
+	struct mutex lock;		/* serializes setup and mmap */
+	void *memory;			/* vmalloc_user, shared with userspace */
+	struct hwrw_ring_header *header;
+	struct hwrw_sqe *sq;
+	struct hwrw_cqe *cq;
+	u32 entries;
+	u32 sq_head;			/* the kernel's copies, userspace can't move them */
+	u32 cq_tail;
+	struct task_struct *worker;
+	int doorbell;
+	wait_queue_head_t worker_wait;
+	wait_queue_head_t completion_wait;
+};
+
+/**
+ * Takes at most ring_batch submissions that have room for a completion, and runs them
+ * return value: the number of submissions handled
+ * */
+static u32 ring_run_batch(struct ring *ring)
+{
+	struct hwrw_op ops[ring_batch];
+	u64 user_data[ring_batch];
+	u32 mask = ring->entries - 1;
+	u32 count = ACCESS_ONCE(ring->header->sq_tail) - ring->sq_head;
+	u32 completions = ring->cq_tail - ACCESS_ONCE(ring->header->cq_head);
+	u32 done = 0;
+	u32 i;
+
+	if (count > ring->entries || completions > ring->entries)
+	{
+		/* userspace moved sq_tail or cq_head to nonsense, wait until they are sane again */
+		return 0;
+	}
+	count = min_t(u32, count, ring->entries - completions);
+	count = min_t(u32, count, ring_batch);
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	/* the entries must be read after sq_tail */
+	smp_rmb();
+	for (i = 0; i < count; i++)
+	{
+		const struct hwrw_sqe *sqe = &ring->sq[(ring->sq_head + i) & mask];
+
+		ops[i] = sqe->op;
+		user_data[i] = sqe->user_data;
+	}
+
+	while (done < count)
+	{
+		u32 completed;
+		int result = hwrw_session_transaction(ring->session, &ops[done], count - done, &completed);
+
+		for (i = done; i < done + completed; i++)
+		{
+			struct hwrw_cqe *cqe = &ring->cq[(ring->cq_tail + i) & mask];
+
+			cqe->user_data = user_data[i];
+			cqe->result = ops[i].result;
+			cqe->error = 0;
+		}
+		done += completed;
+		if (result != 0)
+		{
+			/* the failed operation completes with its error, the batch goes on after it */
+			struct hwrw_cqe *cqe = &ring->cq[(ring->cq_tail + done) & mask];
+
+			cqe->user_data = user_data[done];
+			cqe->result = ops[done].result;
+			cqe->error = result;
+			done++;
+		}
+	}
+
+	/* the completions must be written before userspace can see the new cq_tail */
+	smp_wmb();
+	ring->sq_head += count;
+	ring->cq_tail += count;
+	ring->header->sq_head = ring->sq_head;
+	ring->header->cq_tail = ring->cq_tail;
+	wake_up_interruptible(&ring->completion_wait);
+	return count;
+}
+
+static int ring_worker(void *data)
+{
+	struct ring *ring = data;
+	s64 idle_since = hwrw_now_ns();
+
+	while (!kthread_should_stop())
+	{
+		if (ring_run_batch(ring) != 0)
+		{
+			idle_since = hwrw_now_ns();
+			cond_resched();
+			continue;
+		}
+		if (hwrw_now_ns() - idle_since < (s64)ring_idle_us * NSEC_PER_USEC)
+		{
+			cond_resched();
+			continue;
+		}
+
+		/*
+		 * Going idle: publish HWRW_RING_IDLE before looking at sq_tail a last time. Userspace
+		 * stores sq_tail before it looks at the flag, so one of both sees the other.
+		 */
+		ring->header->flags |= HWRW_RING_IDLE;
+		smp_mb();
+		wait_event_interruptible(ring->worker_wait,
+			ring->doorbell || kthread_should_stop() ||
+			ACCESS_ONCE(ring->header->sq_tail) != ring->sq_head);
+		ring->doorbell = 0;
+		ring->header->flags &= ~HWRW_RING_IDLE;
+		idle_since = hwrw_now_ns();
+	}
+	return 0;
+}
+
+/**
+ * Handles HWRW_IOC_RING_SETUP
+ * return value: 0 on success, -EINVAL for a bad number of entries, -EBUSY when the rings exist
+ * */
+static long ring_setup(struct ring *ring, u32 entries)
+{
+	struct task_struct *worker;
+	long result = 0;
+
+	if (entries < 2 || entries > HWRW_RING_MAX_ENTRIES || (entries & (entries - 1)) != 0)
+	{
+		return -EINVAL;
+	}
+
+	mutex_lock(&ring->lock);
+	if (ring->memory != NULL)
+	{
+		result = -EBUSY;
+		goto out;
+	}
+	/* vmalloc_user memory is zeroed and can be mapped into userspace */
+	ring->memory = vmalloc_user(PAGE_ALIGN(HWRW_RING_SIZE(entries)));
+	if (ring->memory == NULL)
+	{
+		result = -ENOMEM;
+		goto out;
+	}
+	ring->header = ring->memory + HWRW_RING_HEADER_OFFSET;
+	ring->sq = ring->memory + HWRW_RING_SQ_OFFSET;
+	ring->cq = ring->memory + HWRW_RING_CQ_OFFSET(entries);
+	ring->entries = entries;
+	ring->header->entries = entries;
+
+	worker = kthread_run(ring_worker, ring, ring_device_name);
+	if (IS_ERR(worker))
+	{
+		vfree(ring->memory);
+		ring->memory = NULL;
+		result = PTR_ERR(worker);
+		goto out;
+	}
+	ring->worker = worker;
+	es6_trace_info("ring_setup", "entries=%u", entries);
+
+out:
+	mutex_unlock(&ring->lock);
+	return result;
+}
+
+static long ring_ioctl(struct file *file, unsigned int command, unsigned long argument)
+{
+	struct ring *ring = file->private_data;
+	struct hwrw_window window;
+
+	switch (command)
+	{
+	case HWRW_IOC_RING_SETUP:
+		return ring_setup(ring, argument);
+	case HWRW_IOC_RING_ENTER:
+		ring->doorbell = 1;
+		wake_up_interruptible(&ring->worker_wait);
+		return 0;
+	case HWRW_IOC_SET_WINDOW:
+		if (copy_from_user(&window, (void __user *)argument, sizeof(window)) != 0)
+		{
+			return -EFAULT;
+		}
+		return hwrw_session_set_window(ring->session, window.base, window.size);
+	default:
+		return -ENOTTY;
+	}
+}
+
+/**
+ * Maps the rings, only offset 0 with at most their size
+ * */
+static int ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ring *ring = file->private_data;
+	int result = -EINVAL;
+
+	mutex_lock(&ring->lock);
+	if (ring->memory != NULL && vma->vm_pgoff == 0 &&
+	    vma->vm_end - vma->vm_start <= PAGE_ALIGN(HWRW_RING_SIZE(ring->entries)))
+	{
+		result = remap_vmalloc_range(vma, ring->memory, 0);
+	}
+	mutex_unlock(&ring->lock);
+	return result;
+}
+
+static unsigned int ring_poll(struct file *file, poll_table *wait)
+{
+	struct ring *ring = file->private_data;
+	unsigned int mask = 0;
+
+	mutex_lock(&ring->lock);
+	if (ring->memory != NULL)
+	{
+		poll_wait(file, &ring->completion_wait, wait);
+		if (ACCESS_ONCE(ring->header->cq_head) != ACCESS_ONCE(ring->cq_tail))
+		{
+			mask = POLLIN | POLLRDNORM;
+		}
+	}
+	mutex_unlock(&ring->lock);
+	return mask;
+}
+
+static int ring_open(struct inode *inode, struct file *file)
+{
+	struct ring *ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+
+	if (ring == NULL)
+	{
+		return -ENOMEM;
+	}
+	ring->session = hwrw_session_create();
+	if (ring->session == NULL)
+	{
+		kfree(ring);
+		return -ENOMEM;
+	}
+	mutex_init(&ring->lock);
+	init_waitqueue_head(&ring->worker_wait);
+	init_waitqueue_head(&ring->completion_wait);
+	file->private_data = ring;
+	return nonseekable_open(inode, file);
+}
+
+/**
+ * A mapping holds a reference to the file, so when this is called the rings are unmapped
+ * */
+static int ring_release(struct inode *inode, struct file *file)
+{
+	struct ring *ring = file->private_data;
+
+	if (ring->worker != NULL)
+	{
+		kthread_stop(ring->worker);
+	}
+	vfree(ring->memory);
+	hwrw_session_destroy(ring->session);
+	kfree(ring);
+	return 0;
+}
+
+static const struct file_operations ring_fops = {
+	.owner = THIS_MODULE,
+	.open = ring_open,
+	.release = ring_release,
+	.poll = ring_poll,
+	.mmap = ring_mmap,
+	.unlocked_ioctl = ring_ioctl,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice ring_device = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = ring_device_name,
+	.fops = &ring_fops,
+};
+
+int hwrw_ring_init(void)
+{
+	int result = misc_register(&ring_device);
+
+	if (result != 0)
+	{
+		printk(KERN_INFO "/dev/%s could not be registered %d\n", ring_device_name, result);
+		return result;
+	}
+	printk(KERN_INFO "/dev/%s created\n", ring_device_name);
+	return 0;
+}
+
+void hwrw_ring_exit(void)
+{
+	misc_deregister(&ring_device);
+}
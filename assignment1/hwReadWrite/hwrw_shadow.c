@@ -0,0 +1,399 @@
+/**
+ * hwrw_shadow.c - the shadow register cache of hwReadWrite
+ * A range of registers can be given a policy with the script command "p <policy> <address> <registers>":
+ *   v  volatile, the default: every access goes to the bus
+ *   c  cacheable: once a register was read or written its value is served from the shadow copy,
+ *      and writes of the value the register already has are skipped
+ *   o  write-only: writes go to the bus and are remembered, reads return the last value written
+ * "f" forgets the values of the cacheable registers, so their next reads go to the bus again.
+ * "s" writes the shadow copies of the cacheable and write-only registers back to the device,
+ * e.g. after a peripheral was reset.
+ * Only aligned register_size accesses use the cache, narrower writes go to the bus and forget
+ * the register they touch. Registers without a policy cost one test of shadow_regions per access.
+ * The waveform player writes from interrupt context and can't take shadow_lock, so it claims
+ * the range of its waveform instead: no policy can be set on a claimed register.
+ *
+ * Only these paths keep the cache coherent: the script commands (sysfs result and write() on
+ * /dev/hwrw), HWRW_IOC_TRANSACTION, stored programs and /dev/hwrw_ring, whose worker runs
+ * transactions. pread() on /dev/hwrw, the sampler, watches, snapshots and burst captures read
+ * the bus, they neither use nor fill the cache. Stores through an mmap() of /dev/hwrw can't
+ * be seen at all: after writing a cached register that way, use "f" before the next read.
+ * */
+#include "hwReadWrite.h"
+
+/**
+ * values and valid point into the same allocation as the region
+ * */
+struct shadow_region
+{
+	u32 base;
+	u32 count;
+	enum shadow_policy policy;
+	u32 *values;
+	u8 *valid;
+	struct shadow_region *next;
+};
+
+struct shadow_claim
+{
+	u32 first;
+	u32 last;
+	struct shadow_claim *next;
+};
+
+static struct shadow_region *shadow_regions = NULL;
+static struct shadow_claim *shadow_claims = NULL;
+static DEFINE_MUTEX(shadow_lock);	/* protects the regions, the claims and the counters */
+
+static u64 shadow_hits = 0;
+static u64 shadow_misses = 0;
+static u64 shadow_writes = 0;
+static u64 shadow_skipped_writes = 0;
+static u64 shadow_synced = 0;
+
+static const char *const policy_names[] = { "volatile", "cacheable", "write-only" };
+
+/**
+ * Finds the region of a register, must be called with shadow_lock held
+ * return value: the region, or NULL when the register has no policy
+ * */
+static struct shadow_region *shadow_find(u32 address)
+{
+	struct shadow_region *region;
+
+	for (region = shadow_regions; region != NULL; region = region->next)
+	{
+		if (address - region->base < region->count * register_size)
+		{
+			return region;
+		}
+	}
+	return NULL;
+}
+
+static void shadow_forget(u32 address)
+{
+	struct shadow_region *region = shadow_find(address & ~(register_size - 1));
+
+	if (region != NULL)
+	{
+		region->valid[(address - region->base) / register_size] = 0;
+	}
+}
+
+/**
+ * Must be called with shadow_lock held
+ * return value: 1 when a register in [first, last] is claimed
+ * */
+static int shadow_claimed(u32 first, u32 last)
+{
+	struct shadow_claim *claim;
+
+	for (claim = shadow_claims; claim != NULL; claim = claim->next)
+	{
+		if (first <= claim->last && claim->first <= last)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int hwrw_shadow_set_policy(u32 base, u32 count, enum shadow_policy policy)
+{
+	struct shadow_region **link;
+	struct shadow_region *region;
+	int result = 0;
+
+	if ((base & (register_size - 1)) != 0 || count == 0 || count > shadow_max_registers ||
+	    base + count * register_size - 1 < base)
+	{
+		return -EINVAL;
+	}
+
+	mutex_lock(&shadow_lock);
+	if (policy != shadow_volatile && shadow_claimed(base, base + count * register_size - 1))
+	{
+		result = -EBUSY;
+		goto out;
+	}
+	for (link = &shadow_regions; *link != NULL; link = &(*link)->next)
+	{
+		region = *link;
+		if (region->base == base && region->count == count)
+		{
+			break;
+		}
+		if (base - region->base < region->count * register_size ||
+		    region->base - base < count * register_size)
+		{
+			result = -EBUSY;
+			goto out;
+		}
+	}
+
+	if (*link != NULL)
+	{
+		/* the same range again changes its policy, the values are read again */
+		region = *link;
+		if (policy == shadow_volatile)
+		{
+			*link = region->next;
+			kfree(region);
+		}
+		else
+		{
+			region->policy = policy;
+			memset(region->valid, 0, count);
+		}
+	}
+	else if (policy != shadow_volatile)
+	{
+		region = kmalloc(sizeof(*region) + count * (sizeof(u32) + sizeof(u8)), GFP_KERNEL);
+		if (region == NULL)
+		{
+			result = -ENOMEM;
+			goto out;
+		}
+		region->base = base;
+		region->count = count;
+		region->policy = policy;
+		region->values = (u32 *)(region + 1);
+		region->valid = (u8 *)(region->values + count);
+		memset(region->valid, 0, count);
+		region->next = shadow_regions;
+		shadow_regions = region;
+	}
+	es6_trace_info("shadow_policy", "address=0x%08x registers=%u policy=%s", base, count, policy_names[policy]);
+
+out:
+	mutex_unlock(&shadow_lock);
+	return result;
+}
+
+int hwrw_shadow_read(u32 address, u32 *value, unsigned int width)
+{
+	struct shadow_region *region;
+	int hit = 0;
+
+	if (likely(ACCESS_ONCE(shadow_regions) == NULL) ||
+	    width != register_size || (address & (register_size - 1)) != 0)
+	{
+		return 0;
+	}
+
+	mutex_lock(&shadow_lock);
+	region = shadow_find(address);
+	if (region != NULL)
+	{
+		u32 index = (address - region->base) / register_size;
+
+		if (region->valid[index])
+		{
+			*value = region->values[index];
+			hit = 1;
+			shadow_hits++;
+		}
+		else
+		{
+			shadow_misses++;
+		}
+	}
+	mutex_unlock(&shadow_lock);
+	return hit;
+}
+
+void hwrw_shadow_fill(u32 address, u32 value, unsigned int width)
+{
+	struct shadow_region *region;
+
+	if (likely(ACCESS_ONCE(shadow_regions) == NULL) ||
+	    width != register_size || (address & (register_size - 1)) != 0)
+	{
+		return;
+	}
+
+	mutex_lock(&shadow_lock);
+	region = shadow_find(address);
+	/* what the bus returns for a write-only register is not what was written */
+	if (region != NULL && region->policy == shadow_cacheable)
+	{
+		u32 index = (address - region->base) / register_size;
+
+		region->values[index] = value;
+		region->valid[index] = 1;
+	}
+	mutex_unlock(&shadow_lock);
+}
+
+int hwrw_shadow_write(u32 address, u32 value, unsigned int width)
+{
+	struct shadow_region *region;
+	int skip = 0;
+
+	if (likely(ACCESS_ONCE(shadow_regions) == NULL))
+	{
+		return 0;
+	}
+
+	mutex_lock(&shadow_lock);
+	if (width != register_size || (address & (register_size - 1)) != 0)
+	{
+		/* the bytes written may be part of one or two cached registers */
+		shadow_forget(address);
+		shadow_forget(address + width - 1);
+	}
+	else if ((region = shadow_find(address)) != NULL)
+	{
+		u32 index = (address - region->base) / register_size;
+
+		if (region->policy == shadow_cacheable && region->valid[index] && region->values[index] == value)
+		{
+			skip = 1;
+			shadow_skipped_writes++;
+		}
+		else
+		{
+			region->values[index] = value;
+			region->valid[index] = 1;
+			shadow_writes++;
+		}
+	}
+	mutex_unlock(&shadow_lock);
+	return skip;
+}
+
+int hwrw_shadow_claim(u32 first, u32 last)
+{
+	struct shadow_region *region;
+	struct shadow_claim *claim;
+	int result = 0;
+
+	mutex_lock(&shadow_lock);
+	for (region = shadow_regions; region != NULL; region = region->next)
+	{
+		if (first <= region->base + (region->count * register_size - 1) && region->base <= last)
+		{
+			result = -EBUSY;
+			goto out;
+		}
+	}
+	claim = kmalloc(sizeof(*claim), GFP_KERNEL);
+	if (claim == NULL)
+	{
+		result = -ENOMEM;
+		goto out;
+	}
+	claim->first = first;
+	claim->last = last;
+	claim->next = shadow_claims;
+	shadow_claims = claim;
+
+out:
+	mutex_unlock(&shadow_lock);
+	return result;
+}
+
+void hwrw_shadow_release(u32 first, u32 last)
+{
+	struct shadow_claim **link;
+	struct shadow_claim *claim;
+
+	mutex_lock(&shadow_lock);
+	for (link = &shadow_claims; (claim = *link) != NULL; link = &claim->next)
+	{
+		if (claim->first == first && claim->last == last)
+		{
+			*link = claim->next;
+			kfree(claim);
+			break;
+		}
+	}
+	mutex_unlock(&shadow_lock);
+}
+
+void hwrw_shadow_flush(void)
+{
+	struct shadow_region *region;
+
+	mutex_lock(&shadow_lock);
+	for (region = shadow_regions; region != NULL; region = region->next)
+	{
+		if (region->policy == shadow_cacheable)
+		{
+			memset(region->valid, 0, region->count);
+		}
+	}
+	mutex_unlock(&shadow_lock);
+}
+
+u32 hwrw_shadow_sync(void)
+{
+	struct shadow_region *region;
+	u32 synced = 0;
+	u32 i;
+
+	mutex_lock(&shadow_lock);
+	for (region = shadow_regions; region != NULL; region = region->next)
+	{
+		for (i = 0; i < region->count; i++)
+		{
+			if (region->valid[i])
+			{
+				hwrw_write(hwrw_translate(region->base + i * register_size), region->values[i], register_size);
+				synced++;
+			}
+		}
+	}
+	shadow_synced += synced;
+	mutex_unlock(&shadow_lock);
+
+	es6_trace_info("shadow_sync", "registers=%u", synced);
+	return synced;
+}
+
+ssize_t hwrw_shadow_show(char *buffer)
+{
+	struct shadow_region *region;
+	size_t size;
+
+	mutex_lock(&shadow_lock);
+	size = scnprintf(buffer, PAGE_SIZE,
+		"hits %llu\nmisses %llu\nwrites %llu\nskipped_writes %llu\nsynced %llu\n",
+		(unsigned long long)shadow_hits, (unsigned long long)shadow_misses,
+		(unsigned long long)shadow_writes, (unsigned long long)shadow_skipped_writes,
+		(unsigned long long)shadow_synced);
+	for (region = shadow_regions; region != NULL; region = region->next)
+	{
+		u32 valid = 0;
+		u32 i;
+
+		for (i = 0; i < region->count; i++)
+		{
+			valid += region->valid[i];
+		}
+		size += scnprintf(&buffer[size], PAGE_SIZE - size, "0x%08x %u %s %u\n",
+			region->base, region->count, policy_names[region->policy], valid);
+	}
+	mutex_unlock(&shadow_lock);
+	return size;
+}
+
+void hwrw_shadow_exit(void)
+{
+	struct shadow_region *region;
+	struct shadow_claim *claim;
+
+	mutex_lock(&shadow_lock);
+	while ((region = shadow_regions) != NULL)
+	{
+		shadow_regions = region->next;
+		kfree(region);
+	}
+	while ((claim = shadow_claims) != NULL)
+	{
+		shadow_claims = claim->next;
+		kfree(claim);
+	}
+	mutex_unlock(&shadow_lock);
+}
@@ -0,0 +1,73 @@
+/*
+ * es6_trace.h - tracing shared by all assignment modules
+ *
+ * Every module that includes this file and uses ES6_TRACE_DEFINE() once gets its own
+ * trace_level parameter, so you can debug one module while the others stay quiet:
+ *   insmod writekernel.ko trace_level=3
+ *   echo 0 > /sys/module/writekernel/parameters/trace_level
+ *
+ * Levels: 0 nothing (default), 1 errors, 2 info, 3 debug (every event on the hot path).
+ *
+ * An event is one line: "<module> <event> key=value key=value ...", for example
+ *   hwReadWrite read address=0x40024000 value=0x00000001
+ * so the log can be filtered and parsed with grep/awk instead of reading sentences.
+ *
+ * Cost: a disabled event is a load of es6_trace_level and a branch that is marked unlikely,
+ * the arguments aren't even evaluated. For production, build with
+ *   make TRACE=0
+ * which compiles every event out (TRACE=1 and TRACE=2 keep the errors, or errors and info).
+ */
+#ifndef ES6_TRACE_H
+#define ES6_TRACE_H
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/cache.h>
+#else
+/* host builds (hwReadWrite/host, hwReadWrite/bench) map printk and module_param themselves */
+#ifndef __read_mostly
+#define __read_mostly
+#endif
+#endif
+
+#ifndef KBUILD_MODNAME
+#define KBUILD_MODNAME "host"
+#endif
+
+/* highest level that is compiled in, set by the makefiles with TRACE=<level> */
+#ifndef ES6_TRACE_MAX_LEVEL
+#define ES6_TRACE_MAX_LEVEL 3
+#endif
+
+#define TRACE_ERROR 1
+#define TRACE_INFO  2
+#define TRACE_DEBUG 3
+
+extern int es6_trace_level;
+
+/* defines the trace_level parameter, use it in exactly one file of a module */
+#define ES6_TRACE_DEFINE() \
+    int es6_trace_level __read_mostly = 0; \
+    module_param_named(trace_level, es6_trace_level, int, S_IRUGO | S_IWUSR); \
+    MODULE_PARM_DESC(trace_level, "0 off, 1 errors, 2 info, 3 every event on the hot path (default 0)")
+
+/* the first test is a constant, so events above ES6_TRACE_MAX_LEVEL don't generate any code */
+#define es6_trace_enabled(level) \
+    ((level) <= ES6_TRACE_MAX_LEVEL && unlikely((level) <= es6_trace_level))
+
+#define es6_trace(level, prefix, event, format, ...) \
+    do \
+    { \
+        if (es6_trace_enabled(level)) \
+        { \
+            printk(prefix KBUILD_MODNAME " " event " " format "\n", ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define es6_trace_error(event, format, ...) es6_trace(TRACE_ERROR, KERN_ERR, event, format, ##__VA_ARGS__)
+#define es6_trace_info(event, format, ...)  es6_trace(TRACE_INFO, KERN_INFO, event, format, ##__VA_ARGS__)
+#define es6_trace_debug(event, format, ...) es6_trace(TRACE_DEBUG, KERN_DEBUG, event, format, ##__VA_ARGS__)
+
+#endif /* ES6_TRACE_H */
@@ -6,17 +6,42 @@
 #include <linux/module.h>    /* Specifically, a module */
 #include <linux/kobject.h>   /* Necessary because we use sysfs */
 #include <linux/device.h>
+#include <linux/mutex.h>
+#include "es6_trace.h"       /* Shared tracing, see the trace_level module parameter */
 
 #define sysfs_dir  "hello"
 #define sysfs_file "helloworld"
+#define sysfs_generation_file "generation"
 
+#define sysfs_max_data_size 64
+
+/*
+ * root can replace the greeting. Every replacement increments the generation and wakes up
+ * anyone who waits for a change in poll() or epoll_wait(), so nobody has to read the file
+ * in a loop to see if it changed.
+ */
+static char message[sysfs_max_data_size] = "HelloWorld!\n";
+static size_t message_size = 12;
+static unsigned long generation = 0;
+static DEFINE_MUTEX(message_lock);
+
+/* 
+ * And finally: we need a kobject to keep our object creation result in. In
+ * sysfs_exit this result is used to delete our created kobject, sysfs_store
+ * uses it to notify the pollers.
+ */ 
+static struct kobject *hello_obj = NULL;
+
+ES6_TRACE_DEFINE();
 
 static ssize_t
 sysfs_show(struct device *dev,
            struct device_attribute *attr,
            char *buffer)
 {
-    printk(KERN_INFO "sysfile_read (/sys/kernel/%s/%s) called\n", sysfs_dir, sysfs_file);
+    ssize_t size;
+
+    es6_trace_debug("show", "file=%s", sysfs_file);
     
     /*
      * In sysfs you are supposed to give little information and all in one go.
@@ -27,10 +52,66 @@ sysfs_show(struct device *dev,
      * In contrary to both procfs and device nodes, the show function will only
      * be called once, so there's no mechanism needed to show we're done.
      *
-     * The return value of this function is the number of bytes we've written into buffer,
-     * which is exactly what sprintf returns.
+     * The return value of this function is the number of bytes we've written into buffer.
+     */
+    mutex_lock(&message_lock);
+    memcpy(buffer, message, message_size);
+    size = message_size;
+    mutex_unlock(&message_lock);
+
+    return size;
+}
+
+static ssize_t
+sysfs_store(struct device *dev,
+            struct device_attribute *attr,
+            const char *buffer,
+            size_t count)
+{
+    /*
+     * A greeting that doesn't fit is refused instead of cut off, so the writer
+     * doesn't believe all of it was stored.
+     */
+    if (count > sysfs_max_data_size)
+    {
+        es6_trace_error("too_large", "file=%s count=%zu max=%d", sysfs_file, count, sysfs_max_data_size);
+        return -EINVAL;
+    }
+
+    mutex_lock(&message_lock);
+    memcpy(message, buffer, count);
+    message_size = count;
+    generation++;
+    mutex_unlock(&message_lock);
+
+    es6_trace_debug("store", "file=%s count=%zu", sysfs_file, count);
+
+    /*
+     * Wake up the pollers. Sysfs only supports this the following way: open the file, read it,
+     * and then poll for POLLPRI | POLLERR. When poll returns, lseek to 0 and read the file again.
      */
-    return sprintf(buffer, "HelloWorld!\n");
+    sysfs_notify(hello_obj, NULL, sysfs_file);
+    sysfs_notify(hello_obj, NULL, sysfs_generation_file);
+
+    return count;
+}
+
+/*
+ * The number of times the greeting was replaced. A reader that remembers the last generation
+ * it saw knows how many updates it missed.
+ */
+static ssize_t
+sysfs_generation_show(struct device *dev,
+                      struct device_attribute *attr,
+                      char *buffer)
+{
+    unsigned long value;
+
+    mutex_lock(&message_lock);
+    value = generation;
+    mutex_unlock(&message_lock);
+
+    return sprintf(buffer, "%lu\n", value);
 }
 
 
@@ -51,12 +132,13 @@ sysfs_show(struct device *dev,
  * that will be created (helloworld) must be without quotes! This is because
  * the name helloworld is also used to form the struct name dev_attr_helloworld.
  */
-static DEVICE_ATTR(helloworld, S_IRUGO, sysfs_show, NULL);
+static DEVICE_ATTR(helloworld, S_IRUGO | S_IWUSR, sysfs_show, sysfs_store);
+static DEVICE_ATTR(generation, S_IRUGO, sysfs_generation_show, NULL);
 
 
 /*
  * Then we must define a list with device attributes (such as we just created)
- * that we support in this module. In our case it's only one attribute. The list
+ * that we support in this module. In our case it's the greeting and its generation. The list
  * with device attributes must be NULL terminated!
  *
  * Please note: while we gave the name 'helloworld' in the DEVICE_ATTR call,
@@ -64,6 +146,7 @@ static DEVICE_ATTR(helloworld, S_IRUGO, sysfs_show, NULL);
  */
 static struct attribute *attrs[] = {
     &dev_attr_helloworld.attr,
+    &dev_attr_generation.attr,
     NULL   /* need to NULL terminate the list of attributes */
 };
 
@@ -75,12 +158,6 @@ static struct attribute_group attr_group = {
     .attrs = attrs,
 };
 
-/* 
- * And finally: we need a kobject to keep our object creation result in. In
- * sysfs_exit this result is used to delete our created kobject
- */ 
-static struct kobject *hello_obj = NULL;
-
 int __init sysfs_init(void)
 {
     int result = 0;
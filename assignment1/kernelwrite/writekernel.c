@@ -6,25 +6,203 @@
 #include <linux/module.h>    /* Specifically, a module */
 #include <linux/kobject.h>   /* Necessary because we use sysfs */
 #include <linux/device.h>
+#include <linux/vmalloc.h>   /* The buffer can grow to megabytes */
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/seqlock.h>   /* Readers take a consistent snapshot without locking */
+#include <linux/rcupdate.h>  /* Old buffers are freed once no reader uses them anymore */
+#include <linux/workqueue.h>
+#include <linux/fs.h>        /* The FIFO is a character device */
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/pipe_fs_i.h> /* splice() hands our pages to a pipe instead of copying them */
+#include <linux/splice.h>
+#include <asm/uaccess.h>
+#include "es6_trace.h"       /* Shared tracing, see the trace_level module parameter */
 
 #define sysfs_dir  "buffer"
 #define sysfs_file "data"
+#define sysfs_bin_file "blob"
+#define sysfs_generation_file "generation"
+#define fifo_device "buffer_fifo"
 
 #define sysfs_max_data_size 1024 /* due to limitations of sysfs, you mustn't go above PAGE_SIZE, 1k is already a *lot* of information for sysfs! */
-static char sysfs_buffer[sysfs_max_data_size+1] = "HelloWorld!\n"; /* an extra byte for the '\0' terminator */
+
+/*
+ * The buffer is shared by the text file "data" and the binary file "blob". The text
+ * file keeps the old 1k limit, the binary file reads and writes any range of the buffer,
+ * which is grown with vmalloc up to max_size bytes.
+ */
+static unsigned long max_size = 4 * 1024 * 1024;
+module_param(max_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(max_size, "maximum size of the buffer in bytes (default 4MB)");
+
+static unsigned long fifo_max_size = 256 * 1024;
+module_param(fifo_max_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(fifo_max_size, "number of bytes /dev/" fifo_device " queues before writers block (default 256kB)");
+
+/*
+ * Any number of readers can read the buffer at the same time, on any core, without taking
+ * a lock and without ever making the writer wait:
+ * - buffer_seqlock: a reader copies its range and checks the sequence number afterwards.
+ *   If a writer changed the buffer in the meantime, the reader just copies again, so it
+ *   never returns half of an old and half of a new write. Readers copy at most a page
+ *   per call, so a retry is cheap.
+ * - RCU: when the buffer grows, the writer publishes a new buffer_version. The old one is
+ *   freed only after every reader that might still be copying from it is done.
+ * - buffer_lock: writers still take turns, they don't block readers.
+ */
+struct buffer_version
+{
+    struct rcu_head rcu;
+    struct work_struct free_work;
+    size_t capacity;
+    char data[0];
+};
+
+static struct buffer_version *sysfs_buffer = NULL;
 static ssize_t used_buffer_size = 0;
+static unsigned long generation = 0;   /* incremented on every write, so readers can see they missed one */
+static DEFINE_SEQLOCK(buffer_seqlock); /* protects the contents of sysfs_buffer, used_buffer_size and generation */
+static DEFINE_MUTEX(buffer_lock);      /* serializes writers */
+static struct kobject *hello_obj = NULL;
+
+ES6_TRACE_DEFINE();
+
+/*
+ * vfree may sleep, so it can't be called from the RCU callback: hand it to a workqueue.
+ */
+static void
+buffer_free_work(struct work_struct *work)
+{
+    vfree(container_of(work, struct buffer_version, free_work));
+}
+
+static void
+buffer_free_rcu(struct rcu_head *rcu)
+{
+    struct buffer_version *version = container_of(rcu, struct buffer_version, rcu);
+
+    INIT_WORK(&version->free_work, buffer_free_work);
+    schedule_work(&version->free_work);
+}
+
+/*
+ * Makes sure the buffer can hold at least size bytes. The capacity is doubled each time,
+ * so writing a large blob in page sized pieces only copies the buffer a few times.
+ * Must be called with buffer_lock held.
+ */
+static int
+buffer_reserve(size_t size)
+{
+    struct buffer_version *old_version = sysfs_buffer;
+    struct buffer_version *new_version;
+    size_t new_capacity = old_version ? old_version->capacity : PAGE_SIZE;
+
+    if (old_version != NULL && size <= old_version->capacity)
+    {
+        return 0;
+    }
+    if (size > max_size)
+    {
+        return -EFBIG;
+    }
+
+    while (new_capacity < size)
+    {
+        new_capacity *= 2;
+    }
+    if (new_capacity > max_size)
+    {
+        new_capacity = max_size;
+    }
+
+    new_version = vmalloc(sizeof(*new_version) + new_capacity);
+    if (new_version == NULL)
+    {
+        return -ENOMEM;
+    }
+    new_version->capacity = new_capacity;
+
+    /* we are the only writer, so the old contents can't change while we copy them */
+    if (old_version != NULL)
+    {
+        memcpy(new_version->data, old_version->data, used_buffer_size);
+    }
+    rcu_assign_pointer(sysfs_buffer, new_version);
+
+    if (old_version != NULL)
+    {
+        call_rcu(&old_version->rcu, buffer_free_rcu);
+    }
+    return 0;
+}
+
+/*
+ * Copies at most count bytes starting at offset into buffer, as one consistent snapshot
+ * return value: the number of bytes copied
+ */
+static ssize_t
+buffer_read(char *buffer, loff_t offset, size_t count)
+{
+    struct buffer_version *version;
+    unsigned int sequence;
+    ssize_t used;
+    ssize_t size;
+
+    rcu_read_lock();
+    do
+    {
+        sequence = read_seqbegin(&buffer_seqlock);
+        version = rcu_dereference(sysfs_buffer);
+        /*
+         * A writer that grows the buffer publishes the new version before it takes the
+         * seqlock, so this may be the old version with the new, larger size. The copy is
+         * retried then, but it must not run past the end of the old version before that.
+         */
+        used = min_t(ssize_t, ACCESS_ONCE(used_buffer_size), version->capacity);
+        size = 0;
+        if (offset < used)
+        {
+            size = min_t(ssize_t, count, used - offset);
+            memcpy(buffer, version->data + offset, size);
+        }
+    } while (read_seqretry(&buffer_seqlock, sequence));
+    rcu_read_unlock();
+
+    return size;
+}
+
+/*
+ * Wakes up everyone who is waiting in poll() or epoll_wait() on data or generation.
+ * Sysfs only supports this the following way: open the file, read it, and then poll for
+ * POLLPRI | POLLERR. When poll returns, lseek to 0 and read the file again.
+ * sysfs_notify may sleep, so call it after the locks are released.
+ */
+static void
+buffer_changed(void)
+{
+    sysfs_notify(hello_obj, NULL, sysfs_file);
+    sysfs_notify(hello_obj, NULL, sysfs_generation_file);
+}
 
 static ssize_t
 sysfs_show(struct device *dev,
            struct device_attribute *attr,
            char *buffer)
 {
-    printk(KERN_INFO "sysfile_read (/sys/kernel/%s/%s) called\n", sysfs_dir, sysfs_file);
+    es6_trace_debug("show", "file=%s", sysfs_file);
     
     /*
-     * The only change here is that we now return sysfs_buffer, rather than a fixed HelloWorld string.
+     * We know how much is used, so copy exactly that instead of scanning for the '\0' with sprintf.
+     * Sysfs rejects a show that fills the whole page, so the text file shows at most what it
+     * accepts in a store, use the blob file for the rest.
      */
-    return sprintf(buffer, "%s", sysfs_buffer);
+    return buffer_read(buffer, 0, sysfs_max_data_size);
 }
 
 static ssize_t
@@ -33,22 +211,132 @@ sysfs_store(struct device *dev,
             const char *buffer,
             size_t count)
 {
-    used_buffer_size = count > sysfs_max_data_size ? sysfs_max_data_size : count; /* handle MIN(used_buffer_size, count) bytes */
-    
-    printk(KERN_INFO "sysfile_write (/sys/kernel/%s/%s) called, buffer: %s, count: %ld\n", sysfs_dir, sysfs_file, buffer, count);
+    size_t size = count > sysfs_max_data_size ? sysfs_max_data_size : count; /* handle MIN(used_buffer_size, count) bytes */
 
-    memcpy(sysfs_buffer, buffer, used_buffer_size);
-    sysfs_buffer[used_buffer_size] = '\0'; /* this is correct, the buffer is declared to be sysfs_max_data_size+1 bytes! */
+    es6_trace_debug("store", "file=%s count=%zu size=%zu", sysfs_file, count, size);
 
-    return used_buffer_size;
+    mutex_lock(&buffer_lock);
+    write_seqlock(&buffer_seqlock);
+    memcpy(sysfs_buffer->data, buffer, size); /* the buffer is always at least a page */
+    used_buffer_size = size;
+    generation++;
+    write_sequnlock(&buffer_seqlock);
+    mutex_unlock(&buffer_lock);
+
+    buffer_changed();
+
+    return size;
+}
+
+/*
+ * The binary file /sys/kernel/buffer/blob. Sysfs calls these with at most a page at a time,
+ * and only for the range the user asked for, so a reader of a few bytes doesn't pay for the
+ * rest of the buffer.
+ */
+static ssize_t
+sysfs_bin_read(struct kobject *kobj,
+               struct bin_attribute *attr,
+               char *buffer,
+               loff_t offset,
+               size_t count)
+{
+    return buffer_read(buffer, offset, count);
 }
 
+/*
+ * A write at offset 0 starts a new blob, later writes extend it. That way 'cat file > blob'
+ * replaces the buffer, no matter if the new content is shorter than the old one.
+ */
+static ssize_t
+sysfs_bin_write(struct kobject *kobj,
+                struct bin_attribute *attr,
+                char *buffer,
+                loff_t offset,
+                size_t count)
+{
+    ssize_t result;
+
+    es6_trace_debug("store", "file=%s offset=%lld count=%zu", sysfs_bin_file, (long long)offset, count);
+    if (offset + count > max_size)
+    {
+        es6_trace_error("too_large", "file=%s offset=%lld count=%zu max=%lu", sysfs_bin_file, (long long)offset, count, max_size);
+        return -EFBIG;
+    }
+
+    mutex_lock(&buffer_lock);
+    result = buffer_reserve(offset + count);
+    if (result == 0)
+    {
+        write_seqlock(&buffer_seqlock);
+        if (offset == 0)
+        {
+            used_buffer_size = 0;
+        }
+        if (offset > used_buffer_size)
+        {
+            memset(sysfs_buffer->data + used_buffer_size, 0, offset - used_buffer_size); /* fill a hole with zeroes */
+        }
+        memcpy(sysfs_buffer->data + offset, buffer, count);
+        if (offset + count > used_buffer_size)
+        {
+            used_buffer_size = offset + count;
+        }
+        generation++;
+        write_sequnlock(&buffer_seqlock);
+        result = count;
+    }
+    mutex_unlock(&buffer_lock);
+
+    if (result > 0)
+    {
+        buffer_changed();
+    }
+
+    return result;
+}
+
+/*
+ * The generation tells how many writes were done since the module was loaded. A reader that
+ * remembers the last generation it saw knows how many updates it missed while it was busy.
+ */
+static ssize_t
+sysfs_generation_show(struct device *dev,
+                      struct device_attribute *attr,
+                      char *buffer)
+{
+    unsigned int sequence;
+    unsigned long value;
+
+    do
+    {
+        sequence = read_seqbegin(&buffer_seqlock);
+        value = generation;
+    } while (read_seqretry(&buffer_seqlock, sequence));
+
+    return sprintf(buffer, "%lu\n", value);
+}
+
+/*
+ * A binary attribute isn't part of the attribute group, it is created separately.
+ * A size of 0 means the size is unknown, so sysfs doesn't limit the offsets for us.
+ */
+static struct bin_attribute bin_attr_blob = {
+    .attr = {
+        .name = sysfs_bin_file,
+        .mode = S_IWUGO | S_IRUGO,
+    },
+    .size = 0,
+    .read = sysfs_bin_read,
+    .write = sysfs_bin_write,
+};
+
 
 /* 
  * This line is now changed: in the previous example, the last parameter to DEVICE_ATTR
  * was NULL, now we add a store function as well. We must also add writing rights to the file:
  */
 static DEVICE_ATTR(data, S_IWUGO | S_IRUGO, sysfs_show, sysfs_store);
+static DEVICE_ATTR(generation, S_IRUGO, sysfs_generation_show, NULL);
 
 
 /*
@@ -56,18 +344,425 @@ static DEVICE_ATTR(data, S_IWUGO | S_IRUGO, sysfs_show, sysfs_store);
  */
 static struct attribute *attrs[] = {
     &dev_attr_data.attr,
+    &dev_attr_generation.attr,
     NULL   /* need to NULL terminate the list of attributes */
 };
 static struct attribute_group attr_group = {
     .attrs = attrs,
 };
-static struct kobject *hello_obj = NULL;
+
+
+/*
+ * The buffer above is a mailbox: every write replaces the previous one. /dev/buffer_fifo is
+ * a stream instead: writes are queued in order and every byte is read exactly once, so any
+ * number of producers can feed a log collector.
+ *
+ * The queue is a list of pages. Writers fill the last page, readers consume from the first.
+ * When the queue holds fifo_max_size bytes, writers block (or get -EAGAIN) until a reader has
+ * made room, so a slow collector slows down the producers instead of losing data.
+ *
+ * splice() and sendfile() don't copy the data at all: the pages are handed to the pipe. The
+ * pipe takes its own reference on a page, so it stays valid after we have dropped it from
+ * the queue. A writer may still append to the last page, but only behind the part that
+ * was handed out, so the pipe never sees bytes change.
+ *
+ * Readers take turns with fifo_reader_lock, so the bytes at the front of the queue can only
+ * be consumed by the reader that holds it. That lets a splice drop fifo_lock while a full
+ * pipe makes it wait, instead of blocking every producer until the pipe is drained.
+ */
+struct fifo_page
+{
+    struct list_head list;
+    struct page *page;
+    unsigned int start; /* first unread byte */
+    unsigned int end;   /* first free byte */
+};
+
+static LIST_HEAD(fifo_pages);
+static size_t fifo_size = 0;          /* unread bytes in the queue */
+static DEFINE_MUTEX(fifo_lock);       /* protects fifo_pages and fifo_size */
+static DEFINE_MUTEX(fifo_reader_lock); /* one reader consumes at a time, taken before fifo_lock */
+static DECLARE_WAIT_QUEUE_HEAD(fifo_read_wait);
+static DECLARE_WAIT_QUEUE_HEAD(fifo_write_wait);
+
+/*
+ * Returns the page to write into, allocating a new one if the last page is full.
+ * Must be called with fifo_lock held.
+ */
+static struct fifo_page *
+fifo_tail(void)
+{
+    struct fifo_page *tail = NULL;
+
+    if (!list_empty(&fifo_pages))
+    {
+        tail = list_entry(fifo_pages.prev, struct fifo_page, list);
+        if (tail->end < PAGE_SIZE)
+        {
+            return tail;
+        }
+    }
+
+    tail = kmalloc(sizeof(*tail), GFP_KERNEL);
+    if (tail == NULL)
+    {
+        return NULL;
+    }
+    tail->page = alloc_page(GFP_KERNEL);
+    if (tail->page == NULL)
+    {
+        kfree(tail);
+        return NULL;
+    }
+    tail->start = 0;
+    tail->end = 0;
+    list_add_tail(&tail->list, &fifo_pages);
+    return tail;
+}
+
+/*
+ * Removes count bytes from the front of the queue. Pages that are completely read are freed,
+ * unless a pipe still holds a reference to them.
+ * Must be called with fifo_lock held.
+ */
+static void
+fifo_consume(size_t count)
+{
+    struct fifo_page *head;
+    size_t size;
+
+    while (count > 0)
+    {
+        head = list_entry(fifo_pages.next, struct fifo_page, list);
+        size = min_t(size_t, count, head->end - head->start);
+        head->start += size;
+        fifo_size -= size;
+        count -= size;
+
+        if (head->start == head->end)
+        {
+            list_del(&head->list);
+            put_page(head->page);
+            kfree(head);
+        }
+    }
+}
+
+static ssize_t
+fifo_read_locked(struct file *file, char __user *buffer, size_t count)
+{
+    struct fifo_page *head;
+    size_t done = 0;
+    size_t size;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    if (mutex_lock_interruptible(&fifo_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    while (fifo_size == 0)
+    {
+        mutex_unlock(&fifo_lock);
+        if (file->f_flags & O_NONBLOCK)
+        {
+            return -EAGAIN;
+        }
+        if (wait_event_interruptible(fifo_read_wait, fifo_size > 0))
+        {
+            return -ERESTARTSYS;
+        }
+        if (mutex_lock_interruptible(&fifo_lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    /* return what is there, like a pipe, instead of waiting until count bytes are available */
+    while (done < count && fifo_size > 0)
+    {
+        head = list_entry(fifo_pages.next, struct fifo_page, list);
+        size = min_t(size_t, count - done, head->end - head->start);
+        if (copy_to_user(buffer + done, page_address(head->page) + head->start, size))
+        {
+            break;
+        }
+        fifo_consume(size);
+        done += size;
+    }
+    mutex_unlock(&fifo_lock);
+
+    if (done == 0)
+    {
+        return -EFAULT;
+    }
+    wake_up_interruptible(&fifo_write_wait);
+    return done;
+}
+
+static ssize_t
+fifo_read(struct file *file, char __user *buffer, size_t count, loff_t *offset)
+{
+    ssize_t result;
+
+    if (mutex_lock_interruptible(&fifo_reader_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    result = fifo_read_locked(file, buffer, count);
+    mutex_unlock(&fifo_reader_lock);
+    return result;
+}
+
+static ssize_t
+fifo_write(struct file *file, const char __user *buffer, size_t count, loff_t *offset)
+{
+    struct fifo_page *tail;
+    size_t done = 0;
+    size_t size;
+    ssize_t result = 0;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    if (mutex_lock_interruptible(&fifo_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    while (done < count)
+    {
+        /* backpressure: wait until a reader has made room */
+        while (fifo_size >= fifo_max_size)
+        {
+            mutex_unlock(&fifo_lock);
+            if (done > 0)
+            {
+                wake_up_interruptible(&fifo_read_wait);
+            }
+            if (file->f_flags & O_NONBLOCK)
+            {
+                return done > 0 ? done : -EAGAIN;
+            }
+            if (wait_event_interruptible(fifo_write_wait, fifo_size < fifo_max_size))
+            {
+                return done > 0 ? done : -ERESTARTSYS;
+            }
+            if (mutex_lock_interruptible(&fifo_lock))
+            {
+                return done > 0 ? done : -ERESTARTSYS;
+            }
+        }
+
+        tail = fifo_tail();
+        if (tail == NULL)
+        {
+            result = -ENOMEM;
+            break;
+        }
+        size = min_t(size_t, count - done, PAGE_SIZE - tail->end);
+        size = min_t(size_t, size, fifo_max_size - fifo_size);
+        if (copy_from_user(page_address(tail->page) + tail->end, buffer + done, size))
+        {
+            result = -EFAULT;
+            break;
+        }
+        tail->end += size;
+        fifo_size += size;
+        done += size;
+    }
+    mutex_unlock(&fifo_lock);
+
+    if (done == 0)
+    {
+        return result;
+    }
+    wake_up_interruptible(&fifo_read_wait);
+    return done;
+}
+
+static void
+fifo_splice_release(struct splice_pipe_desc *spd, unsigned int i)
+{
+    put_page(spd->pages[i]);
+}
+
+static const struct pipe_buf_operations fifo_pipe_buf_ops = {
+    .can_merge = 0,
+    .map = generic_pipe_buf_map,
+    .unmap = generic_pipe_buf_unmap,
+    .confirm = generic_pipe_buf_confirm,
+    .release = generic_pipe_buf_release,
+    .steal = generic_pipe_buf_steal,
+    .get = generic_pipe_buf_get,
+};
+
+/*
+ * Used by splice() and sendfile(). Every queued page becomes a pipe buffer that points into
+ * our page, without copying. Only what the pipe accepted is removed from the queue.
+ * Must be called with fifo_reader_lock held, splice_to_pipe runs without fifo_lock.
+ */
+static ssize_t
+fifo_splice_read_locked(struct file *file, struct pipe_inode_info *pipe,
+                        size_t count, unsigned int flags)
+{
+    struct page *pages[PIPE_BUFFERS];
+    struct partial_page partial[PIPE_BUFFERS];
+    struct splice_pipe_desc spd = {
+        .pages = pages,
+        .partial = partial,
+        .nr_pages = 0,
+        .flags = flags,
+        .ops = &fifo_pipe_buf_ops,
+        .spd_release = fifo_splice_release,
+    };
+    struct fifo_page *fifo_page;
+    size_t size = 0;
+    ssize_t result;
+
+    if (mutex_lock_interruptible(&fifo_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    while (fifo_size == 0)
+    {
+        mutex_unlock(&fifo_lock);
+        if ((file->f_flags & O_NONBLOCK) || (flags & SPLICE_F_NONBLOCK))
+        {
+            return -EAGAIN;
+        }
+        if (wait_event_interruptible(fifo_read_wait, fifo_size > 0))
+        {
+            return -ERESTARTSYS;
+        }
+        if (mutex_lock_interruptible(&fifo_lock))
+        {
+            return -ERESTARTSYS;
+        }
+    }
+
+    list_for_each_entry(fifo_page, &fifo_pages, list)
+    {
+        if (spd.nr_pages == PIPE_BUFFERS || size == count)
+        {
+            break;
+        }
+        get_page(fifo_page->page); /* the pipe's reference, dropped by generic_pipe_buf_release */
+        pages[spd.nr_pages] = fifo_page->page;
+        partial[spd.nr_pages].offset = fifo_page->start;
+        partial[spd.nr_pages].len = min_t(size_t, count - size, fifo_page->end - fifo_page->start);
+        partial[spd.nr_pages].private = 0;
+        size += partial[spd.nr_pages].len;
+        spd.nr_pages++;
+    }
+    mutex_unlock(&fifo_lock);
+
+    /* may wait for room in the pipe, writers can go on queueing behind what was handed out */
+    result = splice_to_pipe(pipe, &spd);
+    if (result > 0)
+    {
+        mutex_lock(&fifo_lock);
+        fifo_consume(result);
+        mutex_unlock(&fifo_lock);
+        wake_up_interruptible(&fifo_write_wait);
+    }
+    return result;
+}
+
+static ssize_t
+fifo_splice_read(struct file *file, loff_t *offset, struct pipe_inode_info *pipe,
+                 size_t count, unsigned int flags)
+{
+    ssize_t result;
+
+    if (mutex_lock_interruptible(&fifo_reader_lock))
+    {
+        return -ERESTARTSYS;
+    }
+    result = fifo_splice_read_locked(file, pipe, count, flags);
+    mutex_unlock(&fifo_reader_lock);
+    return result;
+}
+
+static unsigned int
+fifo_poll(struct file *file, poll_table *wait)
+{
+    unsigned int mask = 0;
+
+    poll_wait(file, &fifo_read_wait, wait);
+    poll_wait(file, &fifo_write_wait, wait);
+
+    if (fifo_size > 0)
+    {
+        mask |= POLLIN | POLLRDNORM;
+    }
+    if (fifo_size < fifo_max_size)
+    {
+        mask |= POLLOUT | POLLWRNORM;
+    }
+    return mask;
+}
+
+static int
+fifo_open(struct inode *inode, struct file *file)
+{
+    return nonseekable_open(inode, file);
+}
+
+static const struct file_operations fifo_fops = {
+    .owner = THIS_MODULE,
+    .open = fifo_open,
+    .read = fifo_read,
+    .write = fifo_write,
+    .splice_read = fifo_splice_read,
+    .poll = fifo_poll,
+    .llseek = no_llseek,
+};
+
+static struct miscdevice fifo_misc = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = fifo_device,
+    .fops = &fifo_fops,
+    .mode = S_IRUGO | S_IWUGO,
+};
+
+static void
+fifo_free(void)
+{
+    struct fifo_page *fifo_page, *next;
+
+    list_for_each_entry_safe(fifo_page, next, &fifo_pages, list)
+    {
+        list_del(&fifo_page->list);
+        put_page(fifo_page->page);
+        kfree(fifo_page);
+    }
+    fifo_size = 0;
+}
 
 
 int __init sysfs_init(void)
 {
     int result = 0;
 
+    /* the buffer starts with a page, with the same HelloWorld as before */
+    mutex_lock(&buffer_lock);
+    result = buffer_reserve(PAGE_SIZE);
+    if (result == 0)
+    {
+        used_buffer_size = sprintf(sysfs_buffer->data, "HelloWorld!\n");
+    }
+    mutex_unlock(&buffer_lock);
+    if (result != 0)
+    {
+        printk (KERN_INFO "%s module failed to load: buffer could not be allocated\n", sysfs_file);
+        return result;
+    }
+
     /*
      * This is identical to previous example.
      */
@@ -75,6 +770,7 @@ int __init sysfs_init(void)
     if (hello_obj == NULL)
     {
         printk (KERN_INFO "%s module failed to load: kobject_create_and_add failed\n", sysfs_file);
+        vfree(sysfs_buffer);
         return -ENOMEM;
     }
 
@@ -84,16 +780,46 @@ int __init sysfs_init(void)
         /* creating files failed, thus we must remove the created directory! */
         printk (KERN_INFO "%s module failed to load: sysfs_create_group failed with result %d\n", sysfs_file, result);
         kobject_put(hello_obj);
+        vfree(sysfs_buffer);
         return -ENOMEM;
     }
 
+    result = sysfs_create_bin_file(hello_obj, &bin_attr_blob);
+    if (result != 0)
+    {
+        printk (KERN_INFO "%s module failed to load: sysfs_create_bin_file failed with result %d\n", sysfs_bin_file, result);
+        kobject_put(hello_obj);
+        vfree(sysfs_buffer);
+        return result;
+    }
+
+    result = misc_register(&fifo_misc);
+    if (result != 0)
+    {
+        printk (KERN_INFO "%s module failed to load: misc_register failed with result %d\n", fifo_device, result);
+        sysfs_remove_bin_file(hello_obj, &bin_attr_blob);
+        kobject_put(hello_obj);
+        vfree(sysfs_buffer);
+        return result;
+    }
+
     printk(KERN_INFO "/sys/kernel/%s/%s created\n", sysfs_dir, sysfs_file);
+    printk(KERN_INFO "/sys/kernel/%s/%s created\n", sysfs_dir, sysfs_bin_file);
+    printk(KERN_INFO "/dev/%s created\n", fifo_device);
     return result;
 }
 
 void __exit sysfs_exit(void)
 {
+    misc_deregister(&fifo_misc);
+    fifo_free();
+    sysfs_remove_bin_file(hello_obj, &bin_attr_blob);
     kobject_put(hello_obj);
+
+    /* wait for old buffers that are still on their way to vfree */
+    rcu_barrier();
+    flush_scheduled_work();
+    vfree(sysfs_buffer);
     printk (KERN_INFO "/sys/kernel/%s/%s removed\n", sysfs_dir, sysfs_file);
 }
 